@@ -24,6 +24,15 @@ inline void luaL_setfuncs(lua_State* L, const luaL_Reg* l, int nup) {
 }
 #endif
 
+#if LUA_VERSION_NUM < 502
+// lua_rawlen was called lua_objlen before Lua 5.2.
+#define lua_rawlen lua_objlen
+
+// lua_absindex was introduced in Lua 5.2.
+#define lua_absindex(L, i) \
+  ((i) > 0 || (i) <= LUA_REGISTRYINDEX ? (i) : lua_gettop(L) + (i) + 1)
+#endif
+
 #if LUA_VERSION_NUM < 503
 // lua_isinteger was introduced in Lua 5.3. In older versions, all numbers are
 // floats, so we fall back to checking if the value is a number.
@@ -0,0 +1,18 @@
+#ifndef LUA_Z3_LUA_CHECK_HANDLE_HPP_
+#define LUA_Z3_LUA_CHECK_HANDLE_HPP_
+
+#include "z3/Lua.hpp"
+
+struct LuaSolver;
+
+// Start checking a copy of solver, under assumptions, on a worker thread and
+// push a z3.check_handle for it. The copy keeps the solver:set parameters. If
+// options is a valid stack index it holds a table of per-check limits (see
+// solver:check), applied on top of them.
+void pushCheckHandle(lua_State* L, const LuaSolver& solver,
+                     const z3::expr_vector& assumptions, int options);
+
+// Forward declaration of the Lua module opener
+int luaopen_z3_check_handle(lua_State* L);
+
+#endif  // LUA_Z3_LUA_CHECK_HANDLE_HPP_
@@ -3,6 +3,26 @@
 
 #include "z3/Lua.hpp"
 
+// Threading rules: a z3::context is not thread-safe. A context created from
+// Lua, and everything built in it, is only ever used on the thread running
+// the Lua state that owns it. Work moved off that thread (solver:check_async)
+// runs in a private context owned by the worker: inputs are translated into
+// it before the worker starts and results are translated back after it has
+// been joined. The only call a second thread may make into a context it does
+// not own is Z3_interrupt.
+//
+// Every context handed to Lua is a LuaContext. Handles that store a raw
+// context pointer outside of luawrapper (expressions, solvers) retain it, so
+// the context is only deleted once Lua has collected it and the last such
+// handle has been released.
+struct LuaContext : z3::context {
+  unsigned handles = 0;
+  bool collected = false;
+};
+
+void retainContext(z3::context& ctx);
+void releaseContext(z3::context& ctx);
+
 // Forward declaration of the Lua module opener
 int luaopen_z3_context(lua_State* L);
 
@@ -0,0 +1,17 @@
+#ifndef LUA_Z3_LUA_DATATYPE_HPP_
+#define LUA_Z3_LUA_DATATYPE_HPP_
+
+#include "z3/Lua.hpp"
+
+// Datatype sort creation, registered as z3.context methods
+
+// ctx:enum_sort(name, values) -> sort, constants, testers
+int Context_enum_sort(lua_State* L);
+
+// ctx:datatype(name, constructors) -> sort, declarations
+int Context_datatype(lua_State* L);
+
+// ctx:datatypes({{name, constructors}, ...}) -> sorts, declarations
+int Context_datatypes(lua_State* L);
+
+#endif  // LUA_Z3_LUA_DATATYPE_HPP_
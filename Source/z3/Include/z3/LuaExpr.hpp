@@ -2,6 +2,34 @@
 #define LUA_Z3_LUA_EXPR_HPP_
 
 #include "z3/Lua.hpp"
+#include <string>
+
+// Expressions are not managed by luawrapper. A z3::expr is only a context
+// pointer and a reference-counted Z3_ast, so it is stored by value inside the
+// userdata block itself; its __gc runs the destructor, which drops the single
+// reference. These helpers replace luaW_check/luaW_push for expressions.
+z3::expr* checkExpr(lua_State* L, int index);
+z3::expr* toExpr(lua_State* L, int index);
+void pushExpr(lua_State* L, z3::expr expr);
+
+// Get the expression at index, or build a numeral of the given sort when it
+// is a Lua number, boolean or decimal string.
+z3::expr checkOperand(lua_State* L, int index, const z3::sort& sort);
+
+// Append every element of the array table or z3.expr_vector at index to vec.
+void checkExprArray(lua_State* L, int index, z3::expr_vector& vec);
+
+// Format a double as the shortest decimal string that reads back as the same
+// value, in the plain notation Z3 accepts for numerals.
+std::string toDecimalString(double value);
+
+// Stream formulas to the file at path as SMT-LIB2 assertions, each preceded
+// by the declarations it needs. Memory use is bounded by the largest single
+// formula. Options at index (may be absent): append, check_sat, and declared,
+// a table of declarations already written that is updated in place so that
+// later dumps skip them. Pushes the declared table.
+int writeSmt2(lua_State* L, const char* path, const z3::expr_vector& formulas,
+              int options, bool check_sat);
 
 // Forward declaration of the Lua module opener
 int luaopen_z3_expr(lua_State* L);
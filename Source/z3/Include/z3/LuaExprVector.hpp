@@ -0,0 +1,16 @@
+#ifndef LUA_Z3_LUA_EXPR_VECTOR_HPP_
+#define LUA_Z3_LUA_EXPR_VECTOR_HPP_
+
+#include "z3/Lua.hpp"
+
+// Like expressions, expression vectors are stored by value inside their
+// userdata block rather than managed by luawrapper. Elements only become
+// z3.expr userdata when they are indexed from Lua.
+z3::expr_vector* checkExprVector(lua_State* L, int index);
+z3::expr_vector* toExprVector(lua_State* L, int index);
+void pushExprVector(lua_State* L, z3::expr_vector vec);
+
+// Forward declaration of the Lua module opener
+int luaopen_z3_expr_vector(lua_State* L);
+
+#endif  // LUA_Z3_LUA_EXPR_VECTOR_HPP_
@@ -0,0 +1,14 @@
+#ifndef LUA_Z3_LUA_FUNC_DECL_HPP_
+#define LUA_Z3_LUA_FUNC_DECL_HPP_
+
+#include "z3/Lua.hpp"
+
+z3::func_decl* checkFuncDecl(lua_State* L, int index);
+
+// Push a copy of the declaration as a Lua-owned z3.func_decl
+void pushFuncDecl(lua_State* L, const z3::func_decl& decl);
+
+// Forward declaration of the Lua module opener
+int luaopen_z3_func_decl(lua_State* L);
+
+#endif  // LUA_Z3_LUA_FUNC_DECL_HPP_
@@ -0,0 +1,14 @@
+#ifndef LUA_Z3_LUA_GOAL_HPP_
+#define LUA_Z3_LUA_GOAL_HPP_
+
+#include "z3/Lua.hpp"
+
+z3::goal* checkGoal(lua_State* L, int index);
+
+// Push a copy of the goal as a Lua-owned z3.goal
+void pushGoal(lua_State* L, const z3::goal& goal);
+
+// Forward declaration of the Lua module opener
+int luaopen_z3_goal(lua_State* L);
+
+#endif  // LUA_Z3_LUA_GOAL_HPP_
@@ -3,6 +3,9 @@
 
 #include "z3/Lua.hpp"
 
+// Push an evaluated expression as a Lua value (boolean, integer or string)
+void pushValue(lua_State* L, const z3::expr& result);
+
 // Forward declaration of the Lua module opener
 int luaopen_z3_model(lua_State* L);
 
@@ -0,0 +1,9 @@
+#ifndef LUA_Z3_LUA_OPTIMIZE_HPP_
+#define LUA_Z3_LUA_OPTIMIZE_HPP_
+
+#include "z3/Lua.hpp"
+
+// Forward declaration of the Lua module opener
+int luaopen_z3_optimize(lua_State* L);
+
+#endif  // LUA_Z3_LUA_OPTIMIZE_HPP_
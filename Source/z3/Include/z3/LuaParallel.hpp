@@ -0,0 +1,15 @@
+#ifndef LUA_Z3_LUA_PARALLEL_HPP_
+#define LUA_Z3_LUA_PARALLEL_HPP_
+
+#include "z3/Lua.hpp"
+
+// Parallel solving strategies. Each worker solves in a private context of its
+// own, following the threading rules in LuaContext.hpp.
+
+// z3.portfolio(solver_or_assertions, configs)
+int z3_portfolio(lua_State* L);
+
+// z3.cube_and_conquer(solver_or_assertions[, options])
+int z3_cube_and_conquer(lua_State* L);
+
+#endif  // LUA_Z3_LUA_PARALLEL_HPP_
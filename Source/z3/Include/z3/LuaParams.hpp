@@ -0,0 +1,45 @@
+#ifndef LUA_Z3_LUA_PARAMS_HPP_
+#define LUA_Z3_LUA_PARAMS_HPP_
+
+#include "z3/Lua.hpp"
+#include <string>
+#include <vector>
+
+// A parameter table converted to plain data. Unlike z3::params it belongs to
+// no context, so it can be read before any Z3 object exists and applied to
+// solvers in other contexts or threads.
+struct Param {
+  enum Kind { kBool, kUnsigned, kDouble, kSymbol };
+
+  std::string name;
+  Kind kind = kBool;
+  bool bool_value = false;
+  unsigned uint_value = 0;
+  double double_value = 0;
+  std::string symbol_value;
+};
+using ParamList = std::vector<Param>;
+
+// Raise a Lua error unless the value at index is a table of name = value
+// pairs. Booleans and strings map to bool and symbol parameters; numbers
+// become unsigned parameters when they are integral and fit, and doubles
+// otherwise. "timeout_ms" is accepted as an alias for Z3's "timeout", which
+// is also in milliseconds.
+void checkParamTable(lua_State* L, int index);
+
+// Convert a table that passed checkParamTable. Never raises.
+ParamList toParamList(lua_State* L, int index);
+
+// Apply a parameter list to params, which may belong to any context.
+void applyParams(const ParamList& list, z3::params& params);
+
+// Add the entries of from to into, replacing entries of the same name.
+void mergeParams(ParamList& into, const ParamList& from);
+
+// Apply a Lua parameter table (see checkParamTable) to a z3::params.
+void setParams(lua_State* L, int index, z3::params& params);
+
+// Build a fresh z3::params from such a table.
+z3::params checkParams(lua_State* L, int index, z3::context& ctx);
+
+#endif  // LUA_Z3_LUA_PARAMS_HPP_
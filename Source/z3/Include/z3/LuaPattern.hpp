@@ -0,0 +1,15 @@
+#ifndef LUA_Z3_LUA_PATTERN_HPP_
+#define LUA_Z3_LUA_PATTERN_HPP_
+
+#include "z3/Lua.hpp"
+
+// Quantifier instantiation patterns are plain ASTs on the Z3 side; the
+// dedicated z3.pattern type keeps them apart from ordinary expressions.
+z3::ast* checkPattern(lua_State* L, int index);
+z3::ast* toPattern(lua_State* L, int index);
+void pushPattern(lua_State* L, const z3::ast& pattern);
+
+// Forward declaration of the Lua module opener
+int luaopen_z3_pattern(lua_State* L);
+
+#endif  // LUA_Z3_LUA_PATTERN_HPP_
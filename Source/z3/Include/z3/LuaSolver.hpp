@@ -2,6 +2,35 @@
 #define LUA_Z3_LUA_SOLVER_HPP_
 
 #include "z3/Lua.hpp"
+#include "z3/LuaParams.hpp"
+#include <utility>
+
+// Every solver handed to Lua is a LuaSolver. Besides the z3::solver itself it
+// keeps the parameters applied through solver:set, so that the limits passed
+// to a single check can be undone afterwards. They are plain data, so that
+// solver:translate can carry them into another context. When instrumentation
+// is turned on with solver:instrument, it also counts add calls and times
+// each check.
+struct LuaSolver : z3::solver {
+  template <typename... Args>
+  explicit LuaSolver(z3::context& ctx, Args&&... args)
+      : z3::solver(ctx, std::forward<Args>(args)...) {}
+
+  struct Metrics {
+    unsigned checks = 0;
+    unsigned adds = 0;
+    double check_seconds = 0;
+    double last_check_seconds = 0;
+    double max_check_seconds = 0;
+  };
+
+  ParamList params;
+  bool instrumented = false;
+  Metrics metrics;
+};
+
+// Push "sat", "unsat" or "unknown"
+void pushCheckResult(lua_State* L, z3::check_result result);
 
 // Forward declaration of the Lua module opener
 int luaopen_z3_solver(lua_State* L);
@@ -0,0 +1,22 @@
+#ifndef LUA_Z3_LUA_TACTIC_HPP_
+#define LUA_Z3_LUA_TACTIC_HPP_
+
+#include "z3/Lua.hpp"
+
+z3::tactic* checkTactic(lua_State* L, int index);
+
+// Push a copy of the tactic as a Lua-owned z3.tactic
+void pushTactic(lua_State* L, const z3::tactic& tactic);
+
+// Tactic combinators, exposed on the module table
+int z3_Then(lua_State* L);
+int z3_OrElse(lua_State* L);
+int z3_ParOr(lua_State* L);
+int z3_TryFor(lua_State* L);
+int z3_Repeat(lua_State* L);
+int z3_With(lua_State* L);
+
+// Forward declaration of the Lua module opener
+int luaopen_z3_tactic(lua_State* L);
+
+#endif  // LUA_Z3_LUA_TACTIC_HPP_
@@ -0,0 +1,212 @@
+#include "z3/LuaCheckHandle.hpp"
+#include "z3/LuaContext.hpp"
+#include "z3/LuaParams.hpp"
+#include "z3/LuaSolver.hpp"
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+// A check running on a worker thread.
+//
+// The worker owns ctx outright: the solver and assumptions are translated
+// into it on the Lua thread before the worker starts, and results are only
+// read or translated back after it has been joined. While it runs, the only
+// call made into ctx from another thread is Z3_interrupt, which Z3 allows.
+// The caller's context is never touched off the Lua thread.
+struct CheckHandle {
+  CheckHandle(const z3::solver& src, const z3::expr_vector& asms)
+      : origin(src.ctx()),
+        solver(ctx, src, z3::solver::translate()),
+        assumptions(ctx, asms) {
+    retainContext(origin);
+  }
+
+  ~CheckHandle() {
+    stop();
+    join();
+    releaseContext(origin);
+  }
+
+  void start() {
+    worker = std::thread([this] {
+      try {
+        if (cancelled.load(std::memory_order_acquire)) {
+          reason = "canceled";
+        } else {
+          result = assumptions.empty() ? solver.check() : solver.check(assumptions);
+        }
+      } catch (const z3::exception& e) {
+        error = e.msg();
+      }
+      finished.store(true, std::memory_order_release);
+    });
+  }
+
+  // An interrupt that arrives before the worker has entered check is lost,
+  // so keep interrupting until it reports that it has finished. Interrupting
+  // after that would make the next call into ctx fail with "canceled".
+  void stop() {
+    cancelled.store(true, std::memory_order_release);
+    while (worker.joinable() && !finished.load(std::memory_order_acquire)) {
+      ctx.interrupt();
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  void join() {
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+
+  z3::context& origin;
+  z3::context ctx;
+  z3::solver solver;
+  z3::expr_vector assumptions;
+  std::thread worker;
+  std::atomic<bool> cancelled{false};
+  std::atomic<bool> finished{false};
+  z3::check_result result = z3::unknown;
+  std::string reason;  // Set when cancelled before the check started
+  std::string error;
+};
+
+void pushCheckHandle(lua_State* L, const LuaSolver& solver,
+                     const z3::expr_vector& assumptions, int options) {
+  bool limited = !lua_isnoneornil(L, options);
+  if (limited) {
+    checkParamTable(L, options);
+  }
+  CheckHandle* handle;
+  try {
+    handle = new CheckHandle(solver, assumptions);
+  } catch (const z3::exception& e) {
+    luaL_error(L, "z3 error: %s", e.msg());
+    return;
+  }
+  luaW_push<CheckHandle>(L, handle);
+  luaW_hold<CheckHandle>(L, handle);
+  // Translation drops the solver:set parameters, so apply them again, with
+  // the limits of this check on top.
+  try {
+    ParamList settings = solver.params;
+    if (limited) {
+      mergeParams(settings, toParamList(L, options));
+    }
+    z3::params params(handle->ctx);
+    applyParams(settings, params);
+    handle->solver.set(params);
+  } catch (const z3::exception& e) {
+    luaL_error(L, "z3 error: %s", e.msg());
+  }
+  handle->start();
+}
+
+static CheckHandle* checkHandle(lua_State* L, int index) {
+  return luaW_check<CheckHandle>(L, index);
+}
+
+// Wait for the worker, raising any Z3 error it hit
+static CheckHandle* checkFinished(lua_State* L, int index) {
+  auto* handle = checkHandle(L, index);
+  handle->join();
+  if (!handle->error.empty()) {
+    luaL_error(L, "z3 error: %s", handle->error.c_str());
+  }
+  return handle;
+}
+
+// Whether the check has finished; never blocks
+static int CheckHandle_done(lua_State* L) {
+  auto* handle = checkHandle(L, 1);
+  lua_pushboolean(L, handle->finished.load(std::memory_order_acquire));
+  return 1;
+}
+
+// "sat", "unsat" or "unknown" once finished, nil while still running
+static int CheckHandle_result(lua_State* L) {
+  auto* handle = checkHandle(L, 1);
+  if (!handle->finished.load(std::memory_order_acquire)) {
+    lua_pushnil(L);
+    return 1;
+  }
+  checkFinished(L, 1);
+  pushCheckResult(L, handle->result);
+  return 1;
+}
+
+// Block until the check finishes and return its result
+static int CheckHandle_wait(lua_State* L) {
+  auto* handle = checkFinished(L, 1);
+  pushCheckResult(L, handle->result);
+  return 1;
+}
+
+// Interrupt the check and wait until the worker has stopped; the result is
+// then "unknown" unless the check finished first
+static int CheckHandle_cancel(lua_State* L) {
+  auto* handle = checkHandle(L, 1);
+  handle->stop();
+  return 0;
+}
+
+// Get the model in the solver's own context (only valid once the result is sat)
+static int CheckHandle_get_model(lua_State* L) {
+  auto* handle = checkFinished(L, 1);
+  try {
+    z3::model model = handle->solver.get_model();
+    auto* result = new z3::model(model, handle->origin, z3::model::translate());
+    luaW_push<z3::model>(L, result);
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+static int CheckHandle_reason_unknown(lua_State* L) {
+  auto* handle = checkFinished(L, 1);
+  if (!handle->reason.empty()) {
+    lua_pushstring(L, handle->reason.c_str());
+    return 1;
+  }
+  lua_pushstring(L, handle->solver.reason_unknown().c_str());
+  return 1;
+}
+
+static int CheckHandle_tostring(lua_State* L) {
+  lua_pushstring(L, "z3.check_handle");
+  return 1;
+}
+
+// Interrupts and joins a worker that is still running
+static void CheckHandle_deallocator(lua_State* L, CheckHandle* handle) {
+  delete handle;
+}
+
+static luaL_Reg checkHandleTable[] = {
+    {NULL, NULL}
+};
+
+static luaL_Reg checkHandleMetatable[] = {
+    {"done", CheckHandle_done},
+    {"result", CheckHandle_result},
+    {"wait", CheckHandle_wait},
+    {"cancel", CheckHandle_cancel},
+    {"get_model", CheckHandle_get_model},
+    {"reason_unknown", CheckHandle_reason_unknown},
+    {"__tostring", CheckHandle_tostring},
+    {NULL, NULL}
+};
+
+int luaopen_z3_check_handle(lua_State* L) {
+  LUAZ3_REGISTER_TYPE<CheckHandle>(
+      L,
+      "z3.check_handle",
+      checkHandleTable,
+      checkHandleMetatable,
+      nullptr,
+      CheckHandle_deallocator
+  );
+  return 1;
+}
@@ -1,4 +1,10 @@
 #include "z3/LuaContext.hpp"
+#include "z3/LuaDatatype.hpp"
+#include "z3/LuaExpr.hpp"
+#include "z3/LuaExprVector.hpp"
+#include "z3/LuaFuncDecl.hpp"
+#include "z3/LuaPattern.hpp"
+#include <string>
 
 // Helper to get a context pointer from the Lua stack
 static z3::context* checkContext(lua_State* L, int index) {
@@ -7,44 +13,234 @@ static z3::context* checkContext(lua_State* L, int index) {
 
 // Context methods
 
+// Expressions requested by name or as small literals are cached per context,
+// so asking for the same one again returns the same userdata instead of a
+// new allocation. Each context gets a table of weak-valued caches, one per
+// kind of request, stored in a registry table with weak keys so that it goes
+// away together with the context userdata.
+static const char* const kExprCacheKey = "z3.expr_cache";
+
+// Integer literals in [-kCachedIntRange, kCachedIntRange] are cached
+static const lua_Integer kCachedIntRange = 4096;
+
+// Push the cache of the given kind for the context at index 1
+static void pushExprCache(lua_State* L, const char* kind) {
+  lua_getfield(L, LUA_REGISTRYINDEX, kExprCacheKey);
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_pushstring(L, "k");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, LUA_REGISTRYINDEX, kExprCacheKey);
+  }
+  lua_pushvalue(L, 1);
+  lua_rawget(L, -2);
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushvalue(L, 1);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, -4);
+  }
+  lua_getfield(L, -1, kind);
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_pushstring(L, "v");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -3, kind);
+  }
+  lua_replace(L, -3);
+  lua_pop(L, 1);
+}
+
+// Push the cached expression for the key at the top of the stack, creating
+// it with make() on a miss. The key is consumed.
+template <typename Make>
+static int pushCachedExpr(lua_State* L, const char* kind, Make make) {
+  int key = lua_gettop(L);
+  pushExprCache(L, kind);
+  lua_pushvalue(L, key);
+  lua_rawget(L, -2);
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    pushExpr(L, make());
+    lua_pushvalue(L, key);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, -4);
+  }
+  return 1;
+}
+
 static int Context_bool_const(lua_State* L) {
   auto* ctx = checkContext(L, 1);
   const char* name = luaL_checkstring(L, 2);
-  auto* expr = new z3::expr(ctx->bool_const(name));
-  luaW_push<z3::expr>(L, expr);
-  return 1;
+  lua_pushvalue(L, 2);
+  return pushCachedExpr(L, "bool_const", [&] { return ctx->bool_const(name); });
 }
 
 static int Context_int_const(lua_State* L) {
   auto* ctx = checkContext(L, 1);
   const char* name = luaL_checkstring(L, 2);
-  auto* expr = new z3::expr(ctx->int_const(name));
-  luaW_push<z3::expr>(L, expr);
-  return 1;
+  lua_pushvalue(L, 2);
+  return pushCachedExpr(L, "int_const", [&] { return ctx->int_const(name); });
 }
 
 static int Context_real_const(lua_State* L) {
   auto* ctx = checkContext(L, 1);
   const char* name = luaL_checkstring(L, 2);
-  auto* expr = new z3::expr(ctx->real_const(name));
-  luaW_push<z3::expr>(L, expr);
-  return 1;
+  lua_pushvalue(L, 2);
+  return pushCachedExpr(L, "real_const", [&] { return ctx->real_const(name); });
 }
 
 static int Context_bv_const(lua_State* L) {
   auto* ctx = checkContext(L, 1);
   const char* name = luaL_checkstring(L, 2);
   unsigned sz = static_cast<unsigned>(luaL_checkinteger(L, 3));
-  auto* expr = new z3::expr(ctx->bv_const(name, sz));
-  luaW_push<z3::expr>(L, expr);
-  return 1;
+  lua_pushfstring(L, "%s:%d", name, static_cast<int>(sz));
+  return pushCachedExpr(L, "bv_const", [&] { return ctx->bv_const(name, sz); });
 }
 
 static int Context_string_const(lua_State* L) {
   auto* ctx = checkContext(L, 1);
   const char* name = luaL_checkstring(L, 2);
-  auto* expr = new z3::expr(ctx->string_const(name));
-  luaW_push<z3::expr>(L, expr);
+  pushExpr(L, ctx->string_const(name));
+  return 1;
+}
+
+// Constant of any sort, e.g. an enumeration or datatype sort
+static int Context_constant(lua_State* L) {
+  auto* ctx = checkContext(L, 1);
+  const char* name = luaL_checkstring(L, 2);
+  auto* sort = luaW_check<z3::sort>(L, 3);
+  try {
+    pushExpr(L, ctx->constant(name, *sort));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// Batched variable creation
+//
+// Declare many constants of one sort in a single call. Names are taken either
+// from an array table (arg 2) or generated as prefix .. i for i = 1..count.
+// The count is at count_index (0 if there is none); with a names table it is
+// optional and defaults to #names. The sort is created once and the result is
+// returned as an array table.
+static int pushConsts(lua_State* L, z3::context* ctx, const z3::sort& sort,
+                      int count_index) {
+  bool named = lua_istable(L, 2);
+  lua_Integer count = 0;
+  if (named) {
+    lua_Integer available = static_cast<lua_Integer>(lua_rawlen(L, 2));
+    count = available;
+    if (count_index != 0 && !lua_isnoneornil(L, count_index)) {
+      count = luaL_checkinteger(L, count_index);
+      luaL_argcheck(L, count <= available, count_index,
+                    "count exceeds the number of names");
+    }
+    for (lua_Integer i = 1; i <= count; ++i) {
+      lua_rawgeti(L, 2, i);
+      if (lua_type(L, -1) != LUA_TSTRING) {
+        return luaL_argerror(L, 2, "names must be strings");
+      }
+      lua_pop(L, 1);
+    }
+  } else {
+    luaL_checkstring(L, 2);
+    count = luaL_checkinteger(L, count_index);
+  }
+  luaL_argcheck(L, count >= 0, count_index, "count must be non-negative");
+  std::string name = named ? std::string() : lua_tostring(L, 2);
+  size_t prefix_len = name.size();
+  lua_createtable(L, static_cast<int>(count), 0);
+  for (lua_Integer i = 1; i <= count; ++i) {
+    if (named) {
+      lua_rawgeti(L, 2, i);
+      name = lua_tostring(L, -1);
+      lua_pop(L, 1);
+    } else {
+      name.resize(prefix_len);
+      name += std::to_string(i);
+    }
+    Z3_symbol sym = Z3_mk_string_symbol(*ctx, name.c_str());
+    pushExpr(L, z3::expr(*ctx, Z3_mk_const(*ctx, sym, sort)));
+    lua_rawseti(L, -2, i);
+  }
+  return 1;
+}
+
+static int Context_bool_consts(lua_State* L) {
+  auto* ctx = checkContext(L, 1);
+  return pushConsts(L, ctx, ctx->bool_sort(), 3);
+}
+
+static int Context_int_consts(lua_State* L) {
+  auto* ctx = checkContext(L, 1);
+  return pushConsts(L, ctx, ctx->int_sort(), 3);
+}
+
+static int Context_real_consts(lua_State* L) {
+  auto* ctx = checkContext(L, 1);
+  return pushConsts(L, ctx, ctx->real_sort(), 3);
+}
+
+// ctx:bv_consts(prefix, count, size), ctx:bv_consts(names, size) or
+// ctx:bv_consts(names, count, size); the size is always the last argument
+static int Context_bv_consts(lua_State* L) {
+  auto* ctx = checkContext(L, 1);
+  int size_index = 4;
+  int count_index = 3;
+  if (lua_istable(L, 2) && lua_isnoneornil(L, 4)) {
+    size_index = 3;
+    count_index = 0;
+  }
+  lua_Integer sz = luaL_checkinteger(L, size_index);
+  luaL_argcheck(L, sz > 0, size_index, "size must be positive");
+  return pushConsts(L, ctx, ctx->bv_sort(static_cast<unsigned>(sz)),
+                    count_index);
+}
+
+// Create a quantifier instantiation pattern from one or more terms, passed
+// separately or as an array. A multi-term pattern only triggers when all of
+// its terms match.
+static int Context_pattern(lua_State* L) {
+  auto* ctx = checkContext(L, 1);
+  z3::expr_vector terms(*ctx);
+  if (lua_gettop(L) == 2 && (lua_istable(L, 2) || toExprVector(L, 2))) {
+    checkExprArray(L, 2, terms);
+  } else {
+    for (int i = 2; i <= lua_gettop(L); ++i) {
+      terms.push_back(*checkExpr(L, i));
+    }
+  }
+  luaL_argcheck(L, !terms.empty(), 2, "expected at least one term");
+  try {
+    z3::array<Z3_ast> args(terms);
+    Z3_pattern p = Z3_mk_pattern(*ctx, args.size(), args.ptr());
+    ctx->check_error();
+    pushPattern(L, z3::ast(*ctx, reinterpret_cast<Z3_ast>(p)));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// Create a z3.expr_vector, optionally filled from an array of expressions
+static int Context_expr_vector(lua_State* L) {
+  auto* ctx = checkContext(L, 1);
+  z3::expr_vector vec(*ctx);
+  if (!lua_isnoneornil(L, 2)) {
+    checkExprArray(L, 2, vec);
+  }
+  pushExprVector(L, vec);
   return 1;
 }
 
@@ -86,22 +282,99 @@ static int Context_string_sort(lua_State* L) {
   return 1;
 }
 
+// Read a single sort or an array of sorts
+static void checkSorts(lua_State* L, int index, z3::sort_vector& sorts) {
+  if (!lua_istable(L, index)) {
+    sorts.push_back(*luaW_check<z3::sort>(L, index));
+    return;
+  }
+  int n = static_cast<int>(lua_rawlen(L, index));
+  for (int i = 1; i <= n; ++i) {
+    lua_rawgeti(L, index, i);
+    sorts.push_back(*luaW_check<z3::sort>(L, -1));
+    lua_pop(L, 1);
+  }
+}
+
+// Array sort from a domain sort (or an array of domain sorts) to a range
+static int Context_array_sort(lua_State* L) {
+  auto* ctx = checkContext(L, 1);
+  z3::sort_vector domain(*ctx);
+  checkSorts(L, 2, domain);
+  auto* range = luaW_check<z3::sort>(L, 3);
+  try {
+    auto* sort = new z3::sort(ctx->array_sort(domain, *range));
+    luaW_push<z3::sort>(L, sort);
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// Array constant: ctx:array_const(name, domain, range)
+static int Context_array_const(lua_State* L) {
+  auto* ctx = checkContext(L, 1);
+  const char* name = luaL_checkstring(L, 2);
+  z3::sort_vector domain(*ctx);
+  checkSorts(L, 3, domain);
+  auto* range = luaW_check<z3::sort>(L, 4);
+  try {
+    pushExpr(L, ctx->constant(name, ctx->array_sort(domain, *range)));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// Array mapping every index of the domain sort to the same value
+static int Context_const_array(lua_State* L) {
+  checkContext(L, 1);
+  auto* domain = luaW_check<z3::sort>(L, 2);
+  auto* value = checkExpr(L, 3);
+  try {
+    pushExpr(L, z3::const_array(*domain, *value));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// Declare an uninterpreted function: ctx:func_decl(name, domain, range), where
+// domain is a sort or an array of sorts
+static int Context_func_decl(lua_State* L) {
+  auto* ctx = checkContext(L, 1);
+  const char* name = luaL_checkstring(L, 2);
+  z3::sort_vector domain(*ctx);
+  checkSorts(L, 3, domain);
+  auto* range = luaW_check<z3::sort>(L, 4);
+  try {
+    pushFuncDecl(L, ctx->function(name, domain, *range));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
 // Literal value creation
 
 static int Context_bool_val(lua_State* L) {
   auto* ctx = checkContext(L, 1);
   bool val = lua_toboolean(L, 2);
-  auto* expr = new z3::expr(ctx->bool_val(val));
-  luaW_push<z3::expr>(L, expr);
-  return 1;
+  lua_pushboolean(L, val);
+  return pushCachedExpr(L, "bool_val", [&] { return ctx->bool_val(val); });
 }
 
 static int Context_int_val(lua_State* L) {
   auto* ctx = checkContext(L, 1);
   lua_Integer val = luaL_checkinteger(L, 2);
-  auto* expr = new z3::expr(ctx->int_val(static_cast<int64_t>(val)));
-  luaW_push<z3::expr>(L, expr);
-  return 1;
+  if (val < -kCachedIntRange || val > kCachedIntRange) {
+    pushExpr(L, ctx->int_val(static_cast<int64_t>(val)));
+    return 1;
+  }
+  lua_pushinteger(L, val);
+  return pushCachedExpr(L, "int_val", [&] {
+    return ctx->int_val(static_cast<int64_t>(val));
+  });
 }
 
 static int Context_real_val(lua_State* L) {
@@ -109,12 +382,10 @@ static int Context_real_val(lua_State* L) {
   if (lua_isinteger(L, 2)) {
     lua_Integer num = luaL_checkinteger(L, 2);
     lua_Integer den = luaL_optinteger(L, 3, 1);
-    auto* expr = new z3::expr(ctx->real_val(static_cast<int>(num), static_cast<int>(den)));
-    luaW_push<z3::expr>(L, expr);
+    pushExpr(L, ctx->real_val(static_cast<int>(num), static_cast<int>(den)));
   } else {
     const char* val = luaL_checkstring(L, 2);
-    auto* expr = new z3::expr(ctx->real_val(val));
-    luaW_push<z3::expr>(L, expr);
+    pushExpr(L, ctx->real_val(val));
   }
   return 1;
 }
@@ -123,27 +394,68 @@ static int Context_bv_val(lua_State* L) {
   auto* ctx = checkContext(L, 1);
   lua_Integer val = luaL_checkinteger(L, 2);
   unsigned sz = static_cast<unsigned>(luaL_checkinteger(L, 3));
-  auto* expr = new z3::expr(ctx->bv_val(static_cast<int64_t>(val), sz));
-  luaW_push<z3::expr>(L, expr);
+  pushExpr(L, ctx->bv_val(static_cast<int64_t>(val), sz));
   return 1;
 }
 
 static int Context_string_val(lua_State* L) {
   auto* ctx = checkContext(L, 1);
   const char* val = luaL_checkstring(L, 2);
-  auto* expr = new z3::expr(ctx->string_val(val));
-  luaW_push<z3::expr>(L, expr);
+  pushExpr(L, ctx->string_val(val));
   return 1;
 }
 
+// SMT-LIB2 parsing
+//
+// Parse a whole benchmark in C++ and return its assertions as a
+// z3.expr_vector. Use solver:from_string/from_file to load straight into a
+// solver instead.
+
+static int Context_parse_smt2_string(lua_State* L) {
+  auto* ctx = checkContext(L, 1);
+  const char* source = luaL_checkstring(L, 2);
+  try {
+    pushExprVector(L, ctx->parse_string(source));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+static int Context_parse_smt2_file(lua_State* L) {
+  auto* ctx = checkContext(L, 1);
+  const char* path = luaL_checkstring(L, 2);
+  try {
+    pushExprVector(L, ctx->parse_file(path));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+void retainContext(z3::context& ctx) {
+  ++static_cast<LuaContext&>(ctx).handles;
+}
+
+void releaseContext(z3::context& ctx) {
+  auto& owned = static_cast<LuaContext&>(ctx);
+  if (--owned.handles == 0 && owned.collected) {
+    delete &owned;
+  }
+}
+
 // Allocator for creating new context objects
 static z3::context* Context_allocator(lua_State* L) {
-  return new z3::context();
+  return new LuaContext();
 }
 
-// Deallocator
+// Deallocator - defers the delete while handles still refer to the context
 static void Context_deallocator(lua_State* L, z3::context* ctx) {
-  delete ctx;
+  auto* owned = static_cast<LuaContext*>(ctx);
+  owned->collected = true;
+  if (owned->handles == 0) {
+    delete owned;
+  }
 }
 
 static int Context_tostring(lua_State* L) {
@@ -164,18 +476,35 @@ static luaL_Reg contextMetatable[] = {
     {"real_const", Context_real_const},
     {"bv_const", Context_bv_const},
     {"string_const", Context_string_const},
+    {"constant", Context_constant},
+    {"bool_consts", Context_bool_consts},
+    {"int_consts", Context_int_consts},
+    {"real_consts", Context_real_consts},
+    {"bv_consts", Context_bv_consts},
+    {"expr_vector", Context_expr_vector},
     // Sort creation
     {"bool_sort", Context_bool_sort},
     {"int_sort", Context_int_sort},
     {"real_sort", Context_real_sort},
     {"bv_sort", Context_bv_sort},
     {"string_sort", Context_string_sort},
+    {"enum_sort", Context_enum_sort},
+    {"datatype", Context_datatype},
+    {"datatypes", Context_datatypes},
+    {"array_sort", Context_array_sort},
+    {"array_const", Context_array_const},
+    {"const_array", Context_const_array},
+    {"func_decl", Context_func_decl},
+    {"pattern", Context_pattern},
     // Literal values
     {"bool_val", Context_bool_val},
     {"int_val", Context_int_val},
     {"real_val", Context_real_val},
     {"bv_val", Context_bv_val},
     {"string_val", Context_string_val},
+    // SMT-LIB2 parsing
+    {"parse_smt2_string", Context_parse_smt2_string},
+    {"parse_smt2_file", Context_parse_smt2_file},
     // Metamethods
     {"__tostring", Context_tostring},
     {NULL, NULL}
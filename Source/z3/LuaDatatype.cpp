@@ -0,0 +1,266 @@
+#include "z3/LuaDatatype.hpp"
+#include "z3/LuaExpr.hpp"
+#include "z3/LuaFuncDecl.hpp"
+#include <set>
+#include <string>
+#include <vector>
+
+// ctx:enum_sort(name, {"red", "green", "blue"})
+//
+// Returns the sort, its constants and their testers. Both tables are arrays
+// in declaration order that are also keyed by value name.
+int Context_enum_sort(lua_State* L) {
+  auto* ctx = luaW_check<z3::context>(L, 1);
+  const char* name = luaL_checkstring(L, 2);
+  luaL_checktype(L, 3, LUA_TTABLE);
+  int n = static_cast<int>(lua_rawlen(L, 3));
+  luaL_argcheck(L, n > 0, 3, "expected at least one value");
+  std::vector<std::string> names;
+  for (int i = 1; i <= n; ++i) {
+    lua_rawgeti(L, 3, i);
+    names.push_back(luaL_checkstring(L, -1));
+    lua_pop(L, 1);
+  }
+  std::vector<const char*> name_ptrs;
+  for (const auto& value : names) {
+    name_ptrs.push_back(value.c_str());
+  }
+  try {
+    z3::func_decl_vector constants(*ctx);
+    z3::func_decl_vector testers(*ctx);
+    z3::sort sort = ctx->enumeration_sort(name, static_cast<unsigned>(n),
+                                          name_ptrs.data(), constants, testers);
+    luaW_push<z3::sort>(L, new z3::sort(sort));
+    lua_createtable(L, n, n);
+    for (int i = 0; i < n; ++i) {
+      pushExpr(L, constants[i]());
+      lua_pushvalue(L, -1);
+      lua_rawseti(L, -3, i + 1);
+      lua_setfield(L, -2, name_ptrs[i]);
+    }
+    lua_createtable(L, n, n);
+    for (int i = 0; i < n; ++i) {
+      pushFuncDecl(L, testers[i]);
+      lua_pushvalue(L, -1);
+      lua_rawseti(L, -3, i + 1);
+      lua_setfield(L, -2, name_ptrs[i]);
+    }
+    return 3;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// A datatype definition read from Lua before anything is created in Z3, so
+// that malformed input raises a Lua error without leaking Z3 objects.
+struct FieldSpec {
+  std::string name;
+  Z3_sort sort = nullptr;  // nullptr for a reference into the group
+  unsigned ref = 0;        // index of the referenced datatype in the group
+};
+
+struct ConstructorSpec {
+  std::string name;
+  std::vector<FieldSpec> fields;
+};
+
+struct DatatypeSpec {
+  std::string name;
+  std::vector<ConstructorSpec> constructors;
+};
+
+// Read the constructor list at index:
+//   {{"nil"}, {"cons", {"head", int_sort}, {"tail", "List"}}}
+// A field sort is either a z3.sort or the name of a datatype in the group.
+static void checkConstructors(lua_State* L, int index,
+                              const std::vector<std::string>& group,
+                              DatatypeSpec& spec) {
+  index = lua_absindex(L, index);
+  luaL_checktype(L, index, LUA_TTABLE);
+  int n = static_cast<int>(lua_rawlen(L, index));
+  if (n == 0) {
+    luaL_error(L, "datatype %s needs at least one constructor",
+               spec.name.c_str());
+  }
+  // Constructors, testers and accessors share one table of declarations.
+  std::set<std::string> declared;
+  auto declare = [&](const std::string& name) {
+    if (!declared.insert(name).second) {
+      luaL_error(L, "datatype %s declares %s twice", spec.name.c_str(),
+                 name.c_str());
+    }
+  };
+  for (int i = 1; i <= n; ++i) {
+    lua_rawgeti(L, index, i);
+    luaL_checktype(L, -1, LUA_TTABLE);
+    ConstructorSpec ctor;
+    lua_rawgeti(L, -1, 1);
+    ctor.name = luaL_checkstring(L, -1);
+    lua_pop(L, 1);
+    declare(ctor.name);
+    declare("is_" + ctor.name);
+    int fields = static_cast<int>(lua_rawlen(L, -1));
+    for (int j = 2; j <= fields; ++j) {
+      lua_rawgeti(L, -1, j);
+      luaL_checktype(L, -1, LUA_TTABLE);
+      FieldSpec field;
+      lua_rawgeti(L, -1, 1);
+      field.name = luaL_checkstring(L, -1);
+      lua_pop(L, 1);
+      declare(field.name);
+      lua_rawgeti(L, -1, 2);
+      if (lua_type(L, -1) == LUA_TSTRING) {
+        std::string target = lua_tostring(L, -1);
+        size_t k = 0;
+        while (k < group.size() && group[k] != target) {
+          ++k;
+        }
+        if (k == group.size()) {
+          luaL_error(L, "field %s refers to unknown datatype %s",
+                     field.name.c_str(), target.c_str());
+        }
+        field.ref = static_cast<unsigned>(k);
+      } else {
+        field.sort = *luaW_check<z3::sort>(L, -1);
+      }
+      lua_pop(L, 2);
+      ctor.fields.push_back(field);
+    }
+    lua_pop(L, 1);
+    spec.constructors.push_back(ctor);
+  }
+}
+
+// Create the datatypes and push two arrays: the sorts, and per datatype a
+// table of declarations keyed by name (constructors, "is_" testers and field
+// accessors), all z3.func_decl.
+static int pushDatatypes(lua_State* L, z3::context& ctx,
+                         const std::vector<DatatypeSpec>& specs) {
+  // Constructor handles are plain C objects; free them before raising any
+  // error, since luaL_error does not unwind C++ scopes.
+  std::string error;
+  {
+    struct Handles {
+      z3::context& ctx;
+      std::vector<Z3_constructor> constructors;
+      std::vector<Z3_constructor_list> lists;
+      ~Handles() {
+        for (auto list : lists) {
+          Z3_del_constructor_list(ctx, list);
+        }
+        for (auto constructor : constructors) {
+          Z3_del_constructor(ctx, constructor);
+        }
+      }
+    } handles{ctx, {}, {}};
+
+    try {
+      size_t n = specs.size();
+      std::vector<std::vector<Z3_constructor>> groups(n);
+      for (size_t d = 0; d < n; ++d) {
+        for (const auto& ctor : specs[d].constructors) {
+          std::vector<Z3_symbol> field_names;
+          std::vector<Z3_sort> sorts;
+          std::vector<unsigned> refs;
+          for (const auto& field : ctor.fields) {
+            field_names.push_back(Z3_mk_string_symbol(ctx, field.name.c_str()));
+            sorts.push_back(field.sort);
+            refs.push_back(field.ref);
+          }
+          std::string tester = "is_" + ctor.name;
+          Z3_constructor constructor = Z3_mk_constructor(
+              ctx, Z3_mk_string_symbol(ctx, ctor.name.c_str()),
+              Z3_mk_string_symbol(ctx, tester.c_str()),
+              static_cast<unsigned>(ctor.fields.size()), field_names.data(),
+              sorts.data(), refs.data());
+          ctx.check_error();
+          handles.constructors.push_back(constructor);
+          groups[d].push_back(constructor);
+        }
+        handles.lists.push_back(Z3_mk_constructor_list(
+            ctx, static_cast<unsigned>(groups[d].size()), groups[d].data()));
+        ctx.check_error();
+      }
+
+      std::vector<Z3_symbol> names;
+      for (const auto& spec : specs) {
+        names.push_back(Z3_mk_string_symbol(ctx, spec.name.c_str()));
+      }
+      std::vector<Z3_sort> sorts(n);
+      Z3_mk_datatypes(ctx, static_cast<unsigned>(n), names.data(), sorts.data(),
+                      handles.lists.data());
+      ctx.check_error();
+
+      lua_createtable(L, static_cast<int>(n), 0);
+      int sort_table = lua_gettop(L);
+      lua_createtable(L, static_cast<int>(n), 0);
+      int decl_table = lua_gettop(L);
+      for (size_t d = 0; d < n; ++d) {
+        luaW_push<z3::sort>(L, new z3::sort(ctx, sorts[d]));
+        lua_rawseti(L, sort_table, static_cast<int>(d + 1));
+        lua_newtable(L);
+        for (size_t c = 0; c < groups[d].size(); ++c) {
+          const ConstructorSpec& ctor = specs[d].constructors[c];
+          Z3_func_decl constructor;
+          Z3_func_decl tester;
+          std::vector<Z3_func_decl> accessors(ctor.fields.size());
+          Z3_query_constructor(ctx, groups[d][c],
+                               static_cast<unsigned>(ctor.fields.size()),
+                               &constructor, &tester, accessors.data());
+          ctx.check_error();
+          pushFuncDecl(L, z3::func_decl(ctx, constructor));
+          lua_setfield(L, -2, ctor.name.c_str());
+          pushFuncDecl(L, z3::func_decl(ctx, tester));
+          lua_setfield(L, -2, ("is_" + ctor.name).c_str());
+          for (size_t f = 0; f < accessors.size(); ++f) {
+            pushFuncDecl(L, z3::func_decl(ctx, accessors[f]));
+            lua_setfield(L, -2, ctor.fields[f].name.c_str());
+          }
+        }
+        lua_rawseti(L, decl_table, static_cast<int>(d + 1));
+      }
+      return 2;
+    } catch (const z3::exception& e) {
+      error = e.msg();
+    }
+  }
+  return luaL_error(L, "z3 error: %s", error.c_str());
+}
+
+// ctx:datatype(name, constructors), see checkConstructors for the format
+int Context_datatype(lua_State* L) {
+  auto* ctx = luaW_check<z3::context>(L, 1);
+  std::vector<DatatypeSpec> specs(1);
+  specs[0].name = luaL_checkstring(L, 2);
+  checkConstructors(L, 3, {specs[0].name}, specs[0]);
+  pushDatatypes(L, *ctx, specs);
+  // Unwrap the single-element arrays.
+  lua_rawgeti(L, -2, 1);
+  lua_rawgeti(L, -2, 1);
+  return 2;
+}
+
+// ctx:datatypes({{name, constructors}, ...}) for mutually recursive types
+int Context_datatypes(lua_State* L) {
+  auto* ctx = luaW_check<z3::context>(L, 1);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  int n = static_cast<int>(lua_rawlen(L, 2));
+  luaL_argcheck(L, n > 0, 2, "expected at least one datatype");
+  std::vector<std::string> group;
+  for (int i = 1; i <= n; ++i) {
+    lua_rawgeti(L, 2, i);
+    luaL_checktype(L, -1, LUA_TTABLE);
+    lua_rawgeti(L, -1, 1);
+    group.push_back(luaL_checkstring(L, -1));
+    lua_pop(L, 2);
+  }
+  std::vector<DatatypeSpec> specs(n);
+  for (int i = 1; i <= n; ++i) {
+    specs[i - 1].name = group[i - 1];
+    lua_rawgeti(L, 2, i);
+    lua_rawgeti(L, -1, 2);
+    checkConstructors(L, -1, group, specs[i - 1]);
+    lua_pop(L, 2);
+  }
+  return pushDatatypes(L, *ctx, specs);
+}
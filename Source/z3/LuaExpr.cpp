@@ -1,7 +1,209 @@
 #include "z3/LuaExpr.hpp"
+#include "z3/LuaContext.hpp"
+#include "z3/LuaExprVector.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <string>
+#include <utility>
+
+static const char* const kExprMetatable = "z3.expr";
+
+z3::expr* checkExpr(lua_State* L, int index) {
+  return static_cast<z3::expr*>(luaL_checkudata(L, index, kExprMetatable));
+}
+
+// Like checkExpr, but returns nullptr instead of raising an error
+z3::expr* toExpr(lua_State* L, int index) {
+  void* block = lua_touserdata(L, index);
+  if (block == nullptr || !lua_getmetatable(L, index)) {
+    return nullptr;
+  }
+  luaL_getmetatable(L, kExprMetatable);
+  bool is_expr = lua_rawequal(L, -1, -2);
+  lua_pop(L, 2);
+  return is_expr ? static_cast<z3::expr*>(block) : nullptr;
+}
+
+void pushExpr(lua_State* L, z3::expr expr) {
+#if LUA_VERSION_NUM >= 504
+  void* block = lua_newuserdatauv(L, sizeof(z3::expr), 0);
+#else
+  void* block = lua_newuserdata(L, sizeof(z3::expr));
+#endif
+  auto* handle = new (block) z3::expr(std::move(expr));
+  retainContext(handle->ctx());
+  luaL_getmetatable(L, kExprMetatable);
+  lua_setmetatable(L, -2);
+}
+
+void checkExprArray(lua_State* L, int index, z3::expr_vector& vec) {
+  if (auto* src = toExprVector(L, index)) {
+    // Read the size once: src may be vec itself.
+    unsigned n = src->size();
+    for (unsigned i = 0; i < n; ++i) {
+      vec.push_back((*src)[i]);
+    }
+    return;
+  }
+  luaL_checktype(L, index, LUA_TTABLE);
+  int n = static_cast<int>(lua_rawlen(L, index));
+  for (int i = 1; i <= n; ++i) {
+    lua_rawgeti(L, index, i);
+    vec.push_back(*checkExpr(L, -1));
+    lua_pop(L, 1);
+  }
+}
+
+// Z3 numerals take no exponent, so one is expanded into zeros.
+std::string toDecimalString(double value) {
+  char buf[40];
+  for (int precision = 1; precision <= 17; ++precision) {
+    std::snprintf(buf, sizeof(buf), "%.*g", precision, value);
+    if (std::strtod(buf, nullptr) == value) {
+      break;
+    }
+  }
+  std::string text = buf;
+  size_t e = text.find_first_of("eE");
+  if (e == std::string::npos) {
+    return text;
+  }
+  int exponent = std::atoi(text.c_str() + e + 1);
+  std::string mantissa = text.substr(0, e);
+  bool negative = mantissa[0] == '-';
+  if (negative) {
+    mantissa.erase(0, 1);
+  }
+  size_t dot = mantissa.find('.');
+  std::string digits = mantissa;
+  if (dot != std::string::npos) {
+    digits.erase(dot, 1);
+  } else {
+    dot = mantissa.size();
+  }
+  long point = static_cast<long>(dot) + exponent;
+  std::string result;
+  if (point <= 0) {
+    result = "0." + std::string(static_cast<size_t>(-point), '0') + digits;
+  } else if (point >= static_cast<long>(digits.size())) {
+    result = digits + std::string(point - digits.size(), '0');
+  } else {
+    result = digits.substr(0, point) + "." + digits.substr(point);
+  }
+  return negative ? "-" + result : result;
+}
+
+// Read a Lua number as an int64 if it has an integral value that fits
+static bool toInt64(lua_State* L, int index, int64_t& out) {
+#if LUA_VERSION_NUM >= 503
+  if (lua_isinteger(L, index)) {
+    out = static_cast<int64_t>(lua_tointeger(L, index));
+    return true;
+  }
+#endif
+  lua_Number value = lua_tonumber(L, index);
+  if (value == std::floor(value) && value >= -9223372036854775808.0 &&
+      value < 9223372036854775808.0) {
+    out = static_cast<int64_t>(value);
+    return true;
+  }
+  return false;
+}
+
+static z3::expr makeNumeral(z3::context& ctx, const char* text, Z3_sort sort) {
+  Z3_ast r = Z3_mk_numeral(ctx, text, sort);
+  ctx.check_error();
+  return z3::expr(ctx, r);
+}
+
+// Build a numeral of the given sort from a Lua number, boolean or decimal
+// string. Integers keep all 64 bits and bit-vector values wrap to the width
+// of the sort. Fractions become Real numerals; Z3 coerces Int operands to
+// Real where needed. The sort is passed raw so that no C++ object is alive
+// when an argument error is raised.
+static z3::expr toNumeral(lua_State* L, int index, z3::context& ctx,
+                          Z3_sort sort) {
+  Z3_sort_kind kind = Z3_get_sort_kind(ctx, sort);
+  bool numeric =
+      kind == Z3_INT_SORT || kind == Z3_REAL_SORT || kind == Z3_BV_SORT;
+  switch (lua_type(L, index)) {
+    case LUA_TBOOLEAN:
+      if (kind != Z3_BOOL_SORT) {
+        luaL_argerror(L, index, "boolean operand for a non-Boolean expression");
+      }
+      return ctx.bool_val(lua_toboolean(L, index) != 0);
+    case LUA_TSTRING:
+      if (kind == Z3_SEQ_SORT) {
+        return ctx.string_val(lua_tostring(L, index));
+      }
+      if (!numeric) {
+        luaL_argerror(L, index, "string operand for a non-numeric expression");
+      }
+      return makeNumeral(ctx, lua_tostring(L, index), sort);
+    case LUA_TNUMBER:
+      break;
+    default:
+      checkExpr(L, index);  // raises the usual type error
+  }
+  if (!numeric) {
+    luaL_argerror(L, index, "number operand for a non-numeric expression");
+  }
+  int64_t integer;
+  if (toInt64(L, index, integer)) {
+    Z3_ast r = Z3_mk_int64(ctx, integer, sort);
+    ctx.check_error();
+    return z3::expr(ctx, r);
+  }
+  lua_Number value = lua_tonumber(L, index);
+  if (!std::isfinite(value)) {
+    luaL_argerror(L, index, "number is not finite");
+  }
+  // Integral values beyond 64 bits are still exact decimals, which Z3 also
+  // accepts for bit-vector sorts.
+  bool integral = std::floor(value) == value;
+  if (kind == Z3_BV_SORT && !integral) {
+    luaL_argerror(L, index, "bit-vector operand must be an integer");
+  }
+  std::string decimal = toDecimalString(value);
+  return makeNumeral(ctx, decimal.c_str(),
+                     integral ? sort : Z3_mk_real_sort(ctx));
+}
 
-static z3::expr* checkExpr(lua_State* L, int index) {
-  return luaW_check<z3::expr>(L, index);
+z3::expr checkOperand(lua_State* L, int index, const z3::sort& sort) {
+  if (auto* expr = toExpr(L, index)) {
+    return *expr;
+  }
+  return toNumeral(L, index, sort.ctx(), sort);
+}
+
+// Apply a binary operator. Either operand may be a Lua value instead of an
+// expression; it becomes a numeral of the other operand's sort without
+// creating any intermediate Lua object.
+template <typename Op>
+static int pushBinary(lua_State* L, Op op) {
+  z3::expr* a = toExpr(L, 1);
+  z3::expr* b = toExpr(L, 2);
+  if (a == nullptr && b == nullptr) {
+    checkExpr(L, 1);
+  }
+  try {
+    if (a == nullptr) {
+      Z3_sort sort = Z3_get_sort(b->ctx(), *b);
+      pushExpr(L, op(toNumeral(L, 1, b->ctx(), sort), *b));
+    } else if (b == nullptr) {
+      Z3_sort sort = Z3_get_sort(a->ctx(), *a);
+      pushExpr(L, op(*a, toNumeral(L, 2, a->ctx(), sort)));
+    } else {
+      pushExpr(L, op(*a, *b));
+    }
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
 }
 
 // Get the sort of this expression
@@ -52,249 +254,232 @@ static int Expr_is_const(lua_State* L) {
 // Simplify expression
 static int Expr_simplify(lua_State* L) {
   auto* expr = checkExpr(L, 1);
-  auto* result = new z3::expr(expr->simplify());
-  luaW_push<z3::expr>(L, result);
+  pushExpr(L, expr->simplify());
   return 1;
 }
 
-// Substitute variables
-static int Expr_substitute(lua_State* L) {
+// Copy the expression into another context
+static int Expr_translate(lua_State* L) {
   auto* expr = checkExpr(L, 1);
-  auto* from = luaW_check<z3::expr>(L, 2);
-  auto* to = luaW_check<z3::expr>(L, 3);
-  z3::expr_vector from_vec(from->ctx());
-  z3::expr_vector to_vec(from->ctx());
-  from_vec.push_back(*from);
-  to_vec.push_back(*to);
-  auto* result = new z3::expr(expr->substitute(from_vec, to_vec));
-  luaW_push<z3::expr>(L, result);
+  auto* target = luaW_check<z3::context>(L, 2);
+  Z3_ast ast = Z3_translate(expr->ctx(), *expr, *target);
+  try {
+    expr->ctx().check_error();
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+  pushExpr(L, z3::expr(*target, ast));
   return 1;
 }
 
-// Arithmetic operations
-static int Expr_add(lua_State* L) {
-  auto* a = checkExpr(L, 1);
-  if (lua_isnumber(L, 2)) {
-    lua_Integer val = luaL_checkinteger(L, 2);
-    auto* result = new z3::expr(*a + static_cast<int>(val));
-    luaW_push<z3::expr>(L, result);
+// Substitute variables: expr:substitute(from, to) for a single pair, or two
+// arrays (or z3.expr_vectors) of matching length, replaced in one traversal
+static int Expr_substitute(lua_State* L) {
+  auto* expr = checkExpr(L, 1);
+  z3::expr_vector from_vec(expr->ctx());
+  z3::expr_vector to_vec(expr->ctx());
+  if (auto* from = toExpr(L, 2)) {
+    from_vec.push_back(*from);
+    to_vec.push_back(*checkExpr(L, 3));
   } else {
-    auto* b = checkExpr(L, 2);
-    auto* result = new z3::expr(*a + *b);
-    luaW_push<z3::expr>(L, result);
+    checkExprArray(L, 2, from_vec);
+    checkExprArray(L, 3, to_vec);
+    if (from_vec.size() != to_vec.size()) {
+      return luaL_error(L, "substitute: %d sources but %d replacements",
+                        static_cast<int>(from_vec.size()),
+                        static_cast<int>(to_vec.size()));
+    }
   }
-  return 1;
+  try {
+    pushExpr(L, expr->substitute(from_vec, to_vec));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// Arithmetic operations
+static int Expr_add(lua_State* L) {
+  return pushBinary(L, [](const z3::expr& a, const z3::expr& b) {
+    return a + b;
+  });
 }
 
 static int Expr_sub(lua_State* L) {
-  auto* a = checkExpr(L, 1);
-  if (lua_isnumber(L, 2)) {
-    lua_Integer val = luaL_checkinteger(L, 2);
-    auto* result = new z3::expr(*a - static_cast<int>(val));
-    luaW_push<z3::expr>(L, result);
-  } else {
-    auto* b = checkExpr(L, 2);
-    auto* result = new z3::expr(*a - *b);
-    luaW_push<z3::expr>(L, result);
-  }
-  return 1;
+  return pushBinary(L, [](const z3::expr& a, const z3::expr& b) {
+    return a - b;
+  });
 }
 
 static int Expr_mul(lua_State* L) {
-  auto* a = checkExpr(L, 1);
-  if (lua_isnumber(L, 2)) {
-    lua_Integer val = luaL_checkinteger(L, 2);
-    auto* result = new z3::expr(*a * static_cast<int>(val));
-    luaW_push<z3::expr>(L, result);
-  } else {
-    auto* b = checkExpr(L, 2);
-    auto* result = new z3::expr(*a * *b);
-    luaW_push<z3::expr>(L, result);
-  }
-  return 1;
+  return pushBinary(L, [](const z3::expr& a, const z3::expr& b) {
+    return a * b;
+  });
 }
 
 static int Expr_div(lua_State* L) {
-  auto* a = checkExpr(L, 1);
-  if (lua_isnumber(L, 2)) {
-    lua_Integer val = luaL_checkinteger(L, 2);
-    auto* result = new z3::expr(*a / static_cast<int>(val));
-    luaW_push<z3::expr>(L, result);
-  } else {
-    auto* b = checkExpr(L, 2);
-    auto* result = new z3::expr(*a / *b);
-    luaW_push<z3::expr>(L, result);
-  }
-  return 1;
+  return pushBinary(L, [](const z3::expr& a, const z3::expr& b) {
+    return a / b;
+  });
 }
 
 static int Expr_mod(lua_State* L) {
-  auto* a = checkExpr(L, 1);
-  auto* b = checkExpr(L, 2);
-  auto* result = new z3::expr(z3::mod(*a, *b));
-  luaW_push<z3::expr>(L, result);
-  return 1;
+  return pushBinary(L, [](const z3::expr& a, const z3::expr& b) {
+    return z3::mod(a, b);
+  });
 }
 
 static int Expr_unm(lua_State* L) {
   auto* a = checkExpr(L, 1);
-  auto* result = new z3::expr(-(*a));
-  luaW_push<z3::expr>(L, result);
+  pushExpr(L, -(*a));
   return 1;
 }
 
 static int Expr_pow(lua_State* L) {
-  auto* a = checkExpr(L, 1);
-  auto* b = checkExpr(L, 2);
-  auto* result = new z3::expr(z3::pw(*a, *b));
-  luaW_push<z3::expr>(L, result);
-  return 1;
+  return pushBinary(L, [](const z3::expr& a, const z3::expr& b) {
+    return z3::pw(a, b);
+  });
 }
 
 // Comparison operations (return expressions, not booleans!)
 static int Expr_eq(lua_State* L) {
-  auto* a = checkExpr(L, 1);
-  auto* b = checkExpr(L, 2);
-  auto* result = new z3::expr(*a == *b);
-  luaW_push<z3::expr>(L, result);
-  return 1;
+  return pushBinary(L, [](const z3::expr& a, const z3::expr& b) {
+    return a == b;
+  });
 }
 
 static int Expr_ne(lua_State* L) {
-  auto* a = checkExpr(L, 1);
-  auto* b = checkExpr(L, 2);
-  auto* result = new z3::expr(*a != *b);
-  luaW_push<z3::expr>(L, result);
-  return 1;
+  return pushBinary(L, [](const z3::expr& a, const z3::expr& b) {
+    return a != b;
+  });
 }
 
 static int Expr_lt(lua_State* L) {
-  auto* a = checkExpr(L, 1);
-  auto* b = checkExpr(L, 2);
-  auto* result = new z3::expr(*a < *b);
-  luaW_push<z3::expr>(L, result);
-  return 1;
+  return pushBinary(L, [](const z3::expr& a, const z3::expr& b) {
+    return a < b;
+  });
 }
 
 static int Expr_le(lua_State* L) {
-  auto* a = checkExpr(L, 1);
-  auto* b = checkExpr(L, 2);
-  auto* result = new z3::expr(*a <= *b);
-  luaW_push<z3::expr>(L, result);
-  return 1;
+  return pushBinary(L, [](const z3::expr& a, const z3::expr& b) {
+    return a <= b;
+  });
 }
 
 static int Expr_gt(lua_State* L) {
-  auto* a = checkExpr(L, 1);
-  auto* b = checkExpr(L, 2);
-  auto* result = new z3::expr(*a > *b);
-  luaW_push<z3::expr>(L, result);
-  return 1;
+  return pushBinary(L, [](const z3::expr& a, const z3::expr& b) {
+    return a > b;
+  });
 }
 
 static int Expr_ge(lua_State* L) {
-  auto* a = checkExpr(L, 1);
-  auto* b = checkExpr(L, 2);
-  auto* result = new z3::expr(*a >= *b);
-  luaW_push<z3::expr>(L, result);
-  return 1;
+  return pushBinary(L, [](const z3::expr& a, const z3::expr& b) {
+    return a >= b;
+  });
 }
 
 // Logical operations
 static int Expr_land(lua_State* L) {
-  auto* a = checkExpr(L, 1);
-  auto* b = checkExpr(L, 2);
-  auto* result = new z3::expr(*a && *b);
-  luaW_push<z3::expr>(L, result);
-  return 1;
+  return pushBinary(L, [](const z3::expr& a, const z3::expr& b) {
+    return a && b;
+  });
 }
 
 static int Expr_lor(lua_State* L) {
-  auto* a = checkExpr(L, 1);
-  auto* b = checkExpr(L, 2);
-  auto* result = new z3::expr(*a || *b);
-  luaW_push<z3::expr>(L, result);
-  return 1;
+  return pushBinary(L, [](const z3::expr& a, const z3::expr& b) {
+    return a || b;
+  });
 }
 
 static int Expr_lnot(lua_State* L) {
   auto* a = checkExpr(L, 1);
-  auto* result = new z3::expr(!(*a));
-  luaW_push<z3::expr>(L, result);
+  pushExpr(L, !(*a));
   return 1;
 }
 
 static int Expr_implies(lua_State* L) {
-  auto* a = checkExpr(L, 1);
-  auto* b = checkExpr(L, 2);
-  auto* result = new z3::expr(z3::implies(*a, *b));
-  luaW_push<z3::expr>(L, result);
-  return 1;
+  return pushBinary(L, [](const z3::expr& a, const z3::expr& b) {
+    return z3::implies(a, b);
+  });
 }
 
 static int Expr_ite(lua_State* L) {
   auto* cond = checkExpr(L, 1);
   auto* then_expr = checkExpr(L, 2);
   auto* else_expr = checkExpr(L, 3);
-  auto* result = new z3::expr(z3::ite(*cond, *then_expr, *else_expr));
-  luaW_push<z3::expr>(L, result);
+  pushExpr(L, z3::ite(*cond, *then_expr, *else_expr));
   return 1;
 }
 
+// Array operations
+static int Expr_select(lua_State* L) {
+  auto* array = checkExpr(L, 1);
+  try {
+    z3::sort sort = array->get_sort();
+    luaL_argcheck(L, sort.is_array(), 1, "expected an array");
+    z3::expr index = checkOperand(L, 2, sort.array_domain());
+    pushExpr(L, z3::select(*array, index));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+static int Expr_store(lua_State* L) {
+  auto* array = checkExpr(L, 1);
+  try {
+    z3::sort sort = array->get_sort();
+    luaL_argcheck(L, sort.is_array(), 1, "expected an array");
+    z3::expr index = checkOperand(L, 2, sort.array_domain());
+    z3::expr value = checkOperand(L, 3, sort.array_range());
+    pushExpr(L, z3::store(*array, index, value));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
 // Bitvector operations
 static int Expr_bvand(lua_State* L) {
-  auto* a = checkExpr(L, 1);
-  auto* b = checkExpr(L, 2);
-  auto* result = new z3::expr(*a & *b);
-  luaW_push<z3::expr>(L, result);
-  return 1;
+  return pushBinary(L, [](const z3::expr& a, const z3::expr& b) {
+    return a & b;
+  });
 }
 
 static int Expr_bvor(lua_State* L) {
-  auto* a = checkExpr(L, 1);
-  auto* b = checkExpr(L, 2);
-  auto* result = new z3::expr(*a | *b);
-  luaW_push<z3::expr>(L, result);
-  return 1;
+  return pushBinary(L, [](const z3::expr& a, const z3::expr& b) {
+    return a | b;
+  });
 }
 
 static int Expr_bvxor(lua_State* L) {
-  auto* a = checkExpr(L, 1);
-  auto* b = checkExpr(L, 2);
-  auto* result = new z3::expr(*a ^ *b);
-  luaW_push<z3::expr>(L, result);
-  return 1;
+  return pushBinary(L, [](const z3::expr& a, const z3::expr& b) {
+    return a ^ b;
+  });
 }
 
 static int Expr_bvnot(lua_State* L) {
   auto* a = checkExpr(L, 1);
-  auto* result = new z3::expr(~(*a));
-  luaW_push<z3::expr>(L, result);
+  pushExpr(L, ~(*a));
   return 1;
 }
 
 static int Expr_bvshl(lua_State* L) {
-  auto* a = checkExpr(L, 1);
-  auto* b = checkExpr(L, 2);
-  auto* result = new z3::expr(z3::shl(*a, *b));
-  luaW_push<z3::expr>(L, result);
-  return 1;
+  return pushBinary(L, [](const z3::expr& a, const z3::expr& b) {
+    return z3::shl(a, b);
+  });
 }
 
 static int Expr_bvshr(lua_State* L) {
-  auto* a = checkExpr(L, 1);
-  auto* b = checkExpr(L, 2);
-  auto* result = new z3::expr(z3::lshr(*a, *b));
-  luaW_push<z3::expr>(L, result);
-  return 1;
+  return pushBinary(L, [](const z3::expr& a, const z3::expr& b) {
+    return z3::lshr(a, b);
+  });
 }
 
 static int Expr_bvashr(lua_State* L) {
-  auto* a = checkExpr(L, 1);
-  auto* b = checkExpr(L, 2);
-  auto* result = new z3::expr(z3::ashr(*a, *b));
-  luaW_push<z3::expr>(L, result);
-  return 1;
+  return pushBinary(L, [](const z3::expr& a, const z3::expr& b) {
+    return z3::ashr(a, b);
+  });
 }
 
 // Extract bits from bitvector
@@ -302,8 +487,7 @@ static int Expr_extract(lua_State* L) {
   auto* a = checkExpr(L, 1);
   unsigned high = static_cast<unsigned>(luaL_checkinteger(L, 2));
   unsigned low = static_cast<unsigned>(luaL_checkinteger(L, 3));
-  auto* result = new z3::expr(a->extract(high, low));
-  luaW_push<z3::expr>(L, result);
+  pushExpr(L, a->extract(high, low));
   return 1;
 }
 
@@ -311,20 +495,153 @@ static int Expr_extract(lua_State* L) {
 static int Expr_concat(lua_State* L) {
   auto* a = checkExpr(L, 1);
   auto* b = checkExpr(L, 2);
-  auto* result = new z3::expr(z3::concat(*a, *b));
-  luaW_push<z3::expr>(L, result);
+  pushExpr(L, z3::concat(*a, *b));
+  return 1;
+}
+
+// Call fn(form, length) for each top-level s-expression in text, skipping
+// comments. Quoted symbols and string literals may contain parentheses; an
+// escaped quote ("") inside a string simply closes and reopens it.
+template <typename Fn>
+static void forEachForm(const char* text, Fn fn) {
+  const char* start = nullptr;
+  int depth = 0;
+  for (const char* p = text; *p; ++p) {
+    char c = *p;
+    if (c == '"' || c == '|') {
+      const char* end = std::strchr(p + 1, c);
+      if (!end) {
+        return;
+      }
+      p = end;
+    } else if (c == ';' && depth == 0) {
+      while (p[1] && p[1] != '\n') {
+        ++p;
+      }
+    } else if (c == '(') {
+      if (depth++ == 0) {
+        start = p;
+      }
+    } else if (c == ')' && depth > 0) {
+      if (--depth == 0) {
+        fn(start, static_cast<size_t>(p + 1 - start));
+      }
+    }
+  }
+}
+
+static bool startsWith(const char* form, size_t length, const char* prefix) {
+  size_t n = std::strlen(prefix);
+  return length >= n && std::strncmp(form, prefix, n) == 0;
+}
+
+// Each formula is printed on its own by Z3_benchmark_to_smtlib_string and
+// the result is split into top-level forms: assertions are copied to the
+// file, declarations only the first time they are seen, and the status and
+// check-sat boilerplate is dropped.
+int writeSmt2(lua_State* L, const char* path, const z3::expr_vector& formulas,
+              int options, bool check_sat) {
+  bool append = false;
+  if (lua_isnoneornil(L, options)) {
+    lua_pushnil(L);
+  } else {
+    luaL_checktype(L, options, LUA_TTABLE);
+    lua_getfield(L, options, "append");
+    append = lua_toboolean(L, -1);
+    lua_getfield(L, options, "check_sat");
+    if (!lua_isnil(L, -1)) {
+      check_sat = lua_toboolean(L, -1);
+    }
+    lua_getfield(L, options, "declared");
+    if (!lua_isnil(L, -1)) {
+      luaL_checktype(L, -1, LUA_TTABLE);
+    }
+  }
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+  }
+  int declared = lua_gettop(L);
+
+  // The stream must be closed before an error is raised.
+  std::string error;
+  {
+    std::ofstream out(path, append ? std::ios::app : std::ios::trunc);
+    if (!out) {
+      error = std::string("cannot open ") + path;
+    }
+    try {
+      z3::context& ctx = formulas.ctx();
+      for (unsigned i = 0; error.empty() && i < formulas.size(); ++i) {
+        z3::expr formula = formulas[i];
+        const char* text = Z3_benchmark_to_smtlib_string(
+            ctx, "", "", "unknown", "", 0, nullptr, formula);
+        ctx.check_error();
+        forEachForm(text, [&](const char* form, size_t length) {
+          if (startsWith(form, length, "(set-") ||
+              startsWith(form, length, "(check-sat")) {
+            return;
+          }
+          if (!startsWith(form, length, "(assert")) {
+            lua_pushlstring(L, form, length);
+            lua_pushvalue(L, -1);
+            lua_rawget(L, declared);
+            bool seen = lua_toboolean(L, -1);
+            lua_pop(L, 1);
+            if (seen) {
+              lua_pop(L, 1);
+              return;
+            }
+            lua_pushboolean(L, 1);
+            lua_rawset(L, declared);
+          }
+          out.write(form, static_cast<std::streamsize>(length));
+          out << '\n';
+        });
+      }
+    } catch (const z3::exception& e) {
+      error = std::string("z3 error: ") + e.msg();
+    }
+    if (error.empty() && check_sat) {
+      out << "(check-sat)\n";
+    }
+    out.flush();
+    if (error.empty() && !out) {
+      error = std::string("cannot write ") + path;
+    }
+  }
+  if (!error.empty()) {
+    return luaL_error(L, "%s", error.c_str());
+  }
+  lua_pushvalue(L, declared);
   return 1;
 }
 
+// expr:write(path[, options]) writes the declarations the expression needs
+// followed by an assertion of it; see writeSmt2 for the options
+static int Expr_write(lua_State* L) {
+  auto* expr = checkExpr(L, 1);
+  const char* path = luaL_checkstring(L, 2);
+  luaL_argcheck(L, expr->is_bool(), 1, "expected a Boolean expression");
+  z3::expr_vector formulas(expr->ctx());
+  formulas.push_back(*expr);
+  return writeSmt2(L, path, formulas, 3, false);
+}
+
 static int Expr_tostring(lua_State* L) {
   auto* expr = checkExpr(L, 1);
   lua_pushstring(L, expr->to_string().c_str());
   return 1;
 }
 
-// No standalone allocator - expressions are created from context
-static void Expr_deallocator(lua_State* L, z3::expr* expr) {
-  delete expr;
+// Release the Z3_ast reference held by the handle. There is no allocator;
+// expressions are created from a context.
+static int Expr_gc(lua_State* L) {
+  auto* expr = static_cast<z3::expr*>(lua_touserdata(L, 1));
+  z3::context& ctx = expr->ctx();
+  expr->~expr();
+  releaseContext(ctx);
+  return 0;
 }
 
 static luaL_Reg exprTable[] = {
@@ -343,6 +660,7 @@ static luaL_Reg exprMetatable[] = {
     // Transformations
     {"simplify", Expr_simplify},
     {"substitute", Expr_substitute},
+    {"translate", Expr_translate},
     // Arithmetic metamethods
     {"__add", Expr_add},
     {"__sub", Expr_sub},
@@ -364,6 +682,9 @@ static luaL_Reg exprMetatable[] = {
     {"lnot", Expr_lnot},
     {"implies", Expr_implies},
     {"ite", Expr_ite},
+    // Array operations
+    {"select", Expr_select},
+    {"store", Expr_store},
     // Bitvector operations
     {"bvand", Expr_bvand},
     {"bvor", Expr_bvor},
@@ -375,18 +696,27 @@ static luaL_Reg exprMetatable[] = {
     {"extract", Expr_extract},
     {"concat", Expr_concat},
     // String representation
+    {"write", Expr_write},
     {"__tostring", Expr_tostring},
+    // Lifetime
+    {"__gc", Expr_gc},
     {NULL, NULL}
 };
 
+// The expression metatable is registered directly rather than through
+// luawrapper, so pushing an expression needs no identity or storage table
+// bookkeeping. Like the other types, this leaves the type table on the stack.
 int luaopen_z3_expr(lua_State* L) {
-  LUAZ3_REGISTER_TYPE<z3::expr>(
-      L,
-      "z3.expr",
-      exprTable,
-      exprMetatable,
-      nullptr,
-      Expr_deallocator
-  );
+  luaL_newmetatable(L, kExprMetatable);
+  luaL_setfuncs(L, exprMetatable, 0);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 1);
+  lua_newtable(L);
+  luaL_setfuncs(L, exprTable, 0);
+#if LUA_VERSION_NUM < 503
+  lua_pushvalue(L, -1);
+  lua_setglobal(L, kExprMetatable);
+#endif
   return 1;
 }
@@ -0,0 +1,176 @@
+#include "z3/LuaExprVector.hpp"
+#include "z3/LuaContext.hpp"
+#include "z3/LuaExpr.hpp"
+#include <new>
+#include <sstream>
+#include <utility>
+
+static const char* const kExprVectorMetatable = "z3.expr_vector";
+
+z3::expr_vector* checkExprVector(lua_State* L, int index) {
+  return static_cast<z3::expr_vector*>(
+      luaL_checkudata(L, index, kExprVectorMetatable));
+}
+
+// Like checkExprVector, but returns nullptr instead of raising an error
+z3::expr_vector* toExprVector(lua_State* L, int index) {
+  void* block = lua_touserdata(L, index);
+  if (block == nullptr || !lua_getmetatable(L, index)) {
+    return nullptr;
+  }
+  luaL_getmetatable(L, kExprVectorMetatable);
+  bool is_vector = lua_rawequal(L, -1, -2);
+  lua_pop(L, 2);
+  return is_vector ? static_cast<z3::expr_vector*>(block) : nullptr;
+}
+
+void pushExprVector(lua_State* L, z3::expr_vector vec) {
+#if LUA_VERSION_NUM >= 504
+  void* block = lua_newuserdatauv(L, sizeof(z3::expr_vector), 0);
+#else
+  void* block = lua_newuserdata(L, sizeof(z3::expr_vector));
+#endif
+  auto* handle = new (block) z3::expr_vector(std::move(vec));
+  retainContext(handle->ctx());
+  luaL_getmetatable(L, kExprVectorMetatable);
+  lua_setmetatable(L, -2);
+}
+
+// Number of elements
+static int ExprVector_size(lua_State* L) {
+  auto* vec = checkExprVector(L, 1);
+  lua_pushinteger(L, vec->size());
+  return 1;
+}
+
+// Append an expression, or every element of an array or expr_vector
+static int ExprVector_push(lua_State* L) {
+  auto* vec = checkExprVector(L, 1);
+  try {
+    if (auto* expr = toExpr(L, 2)) {
+      vec->push_back(*expr);
+    } else {
+      checkExprArray(L, 2, *vec);
+    }
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+  return 0;
+}
+
+// New vector with elements i..j (1-based, inclusive; j defaults to the end)
+static int ExprVector_slice(lua_State* L) {
+  auto* vec = checkExprVector(L, 1);
+  lua_Integer size = vec->size();
+  lua_Integer first = luaL_optinteger(L, 2, 1);
+  lua_Integer last = luaL_optinteger(L, 3, size);
+  if (first < 1) {
+    first = 1;
+  }
+  if (last > size) {
+    last = size;
+  }
+  z3::expr_vector result(vec->ctx());
+  for (lua_Integer i = first; i <= last; ++i) {
+    result.push_back((*vec)[static_cast<int>(i - 1)]);
+  }
+  pushExprVector(L, result);
+  return 1;
+}
+
+static int ExprVector_iterator(lua_State* L) {
+  auto* vec = checkExprVector(L, 1);
+  lua_Integer i = luaL_checkinteger(L, 2);
+  if (i < 0 || i >= static_cast<lua_Integer>(vec->size())) {
+    return 0;
+  }
+  lua_pushinteger(L, i + 1);
+  pushExpr(L, (*vec)[static_cast<int>(i)]);
+  return 2;
+}
+
+// Generic for iterator: for i, e in vec:iter() do ... end
+static int ExprVector_iter(lua_State* L) {
+  checkExprVector(L, 1);
+  lua_pushcfunction(L, ExprVector_iterator);
+  lua_pushvalue(L, 1);
+  lua_pushinteger(L, 0);
+  return 3;
+}
+
+// Convert to a plain Lua array of expressions
+static int ExprVector_totable(lua_State* L) {
+  auto* vec = checkExprVector(L, 1);
+  unsigned n = vec->size();
+  lua_createtable(L, static_cast<int>(n), 0);
+  for (unsigned i = 0; i < n; ++i) {
+    pushExpr(L, (*vec)[i]);
+    lua_rawseti(L, -2, i + 1);
+  }
+  return 1;
+}
+
+// vec[i] yields the i-th element; any other key looks up a method
+static int ExprVector_index(lua_State* L) {
+  auto* vec = checkExprVector(L, 1);
+  if (lua_type(L, 2) == LUA_TNUMBER) {
+    lua_Integer i = lua_tointeger(L, 2);
+    if (i < 1 || i > static_cast<lua_Integer>(vec->size())) {
+      lua_pushnil(L);
+    } else {
+      pushExpr(L, (*vec)[static_cast<int>(i - 1)]);
+    }
+    return 1;
+  }
+  lua_getmetatable(L, 1);
+  lua_pushvalue(L, 2);
+  lua_rawget(L, -2);
+  return 1;
+}
+
+static int ExprVector_tostring(lua_State* L) {
+  auto* vec = checkExprVector(L, 1);
+  std::ostringstream oss;
+  oss << *vec;
+  lua_pushstring(L, oss.str().c_str());
+  return 1;
+}
+
+static int ExprVector_gc(lua_State* L) {
+  auto* vec = static_cast<z3::expr_vector*>(lua_touserdata(L, 1));
+  z3::context& ctx = vec->ctx();
+  vec->~ast_vector_tpl();
+  releaseContext(ctx);
+  return 0;
+}
+
+static luaL_Reg exprVectorTable[] = {
+    {NULL, NULL}
+};
+
+static luaL_Reg exprVectorMetatable[] = {
+    {"size", ExprVector_size},
+    {"push", ExprVector_push},
+    {"slice", ExprVector_slice},
+    {"iter", ExprVector_iter},
+    {"totable", ExprVector_totable},
+    {"__index", ExprVector_index},
+    {"__len", ExprVector_size},
+    {"__tostring", ExprVector_tostring},
+    {"__gc", ExprVector_gc},
+    {NULL, NULL}
+};
+
+// Registered directly rather than through luawrapper, like z3.expr
+int luaopen_z3_expr_vector(lua_State* L) {
+  luaL_newmetatable(L, kExprVectorMetatable);
+  luaL_setfuncs(L, exprVectorMetatable, 0);
+  lua_pop(L, 1);
+  lua_newtable(L);
+  luaL_setfuncs(L, exprVectorTable, 0);
+#if LUA_VERSION_NUM < 503
+  lua_pushvalue(L, -1);
+  lua_setglobal(L, kExprVectorMetatable);
+#endif
+  return 1;
+}
@@ -0,0 +1,117 @@
+#include "z3/LuaFuncDecl.hpp"
+#include "z3/LuaContext.hpp"
+#include "z3/LuaExpr.hpp"
+#include "z3/LuaExprVector.hpp"
+
+z3::func_decl* checkFuncDecl(lua_State* L, int index) {
+  return luaW_check<z3::func_decl>(L, index);
+}
+
+void pushFuncDecl(lua_State* L, const z3::func_decl& decl) {
+  auto* copy = new z3::func_decl(decl);
+  retainContext(copy->ctx());
+  luaW_push<z3::func_decl>(L, copy);
+  luaW_hold<z3::func_decl>(L, copy);
+}
+
+// Apply the function: f(a, b, ...), f({a, b, ...}) or f:apply(vec). The
+// arguments are collected into one Z3_ast array and applied with a single
+// Z3_mk_app call. Separate arguments may be Lua values, which are converted
+// to the matching domain sort.
+static int FuncDecl_call(lua_State* L) {
+  auto* decl = checkFuncDecl(L, 1);
+  z3::context& ctx = decl->ctx();
+  z3::expr_vector args(ctx);
+  int top = lua_gettop(L);
+  bool packed = top == 2 && (lua_istable(L, 2) || toExprVector(L, 2));
+  if (packed) {
+    checkExprArray(L, 2, args);
+  }
+  unsigned count = packed ? args.size() : static_cast<unsigned>(top - 1);
+  if (count != decl->arity()) {
+    return luaL_error(L, "%s expects %d arguments, got %d",
+                      decl->name().str().c_str(),
+                      static_cast<int>(decl->arity()),
+                      static_cast<int>(count));
+  }
+  try {
+    if (!packed) {
+      for (int i = 2; i <= top; ++i) {
+        args.push_back(checkOperand(L, i, decl->domain(i - 2)));
+      }
+    }
+    pushExpr(L, (*decl)(args));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+static int FuncDecl_name(lua_State* L) {
+  auto* decl = checkFuncDecl(L, 1);
+  lua_pushstring(L, decl->name().str().c_str());
+  return 1;
+}
+
+static int FuncDecl_arity(lua_State* L) {
+  auto* decl = checkFuncDecl(L, 1);
+  lua_pushinteger(L, decl->arity());
+  return 1;
+}
+
+// Get the sort of the i-th argument (1-based)
+static int FuncDecl_domain(lua_State* L) {
+  auto* decl = checkFuncDecl(L, 1);
+  lua_Integer i = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, i >= 1 && i <= static_cast<lua_Integer>(decl->arity()), 2,
+                "index out of range");
+  auto* sort = new z3::sort(decl->domain(static_cast<unsigned>(i - 1)));
+  luaW_push<z3::sort>(L, sort);
+  return 1;
+}
+
+static int FuncDecl_range(lua_State* L) {
+  auto* decl = checkFuncDecl(L, 1);
+  auto* sort = new z3::sort(decl->range());
+  luaW_push<z3::sort>(L, sort);
+  return 1;
+}
+
+static int FuncDecl_tostring(lua_State* L) {
+  auto* decl = checkFuncDecl(L, 1);
+  lua_pushstring(L, decl->to_string().c_str());
+  return 1;
+}
+
+static void FuncDecl_deallocator(lua_State* L, z3::func_decl* decl) {
+  z3::context& ctx = decl->ctx();
+  delete decl;
+  releaseContext(ctx);
+}
+
+static luaL_Reg funcDeclTable[] = {
+    {NULL, NULL}
+};
+
+static luaL_Reg funcDeclMetatable[] = {
+    {"apply", FuncDecl_call},
+    {"name", FuncDecl_name},
+    {"arity", FuncDecl_arity},
+    {"domain", FuncDecl_domain},
+    {"range", FuncDecl_range},
+    {"__call", FuncDecl_call},
+    {"__tostring", FuncDecl_tostring},
+    {NULL, NULL}
+};
+
+int luaopen_z3_func_decl(lua_State* L) {
+  LUAZ3_REGISTER_TYPE<z3::func_decl>(
+      L,
+      "z3.func_decl",
+      funcDeclTable,
+      funcDeclMetatable,
+      nullptr,
+      FuncDecl_deallocator
+  );
+  return 1;
+}
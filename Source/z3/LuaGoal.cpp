@@ -0,0 +1,150 @@
+#include "z3/LuaGoal.hpp"
+#include "z3/LuaContext.hpp"
+#include "z3/LuaExpr.hpp"
+#include "z3/LuaExprVector.hpp"
+#include <sstream>
+
+z3::goal* checkGoal(lua_State* L, int index) {
+  return luaW_check<z3::goal>(L, index);
+}
+
+void pushGoal(lua_State* L, const z3::goal& goal) {
+  auto* copy = new z3::goal(goal);
+  retainContext(copy->ctx());
+  luaW_push<z3::goal>(L, copy);
+  luaW_hold<z3::goal>(L, copy);
+}
+
+// Add a formula, or every formula of an array or z3.expr_vector
+static int Goal_add(lua_State* L) {
+  auto* goal = checkGoal(L, 1);
+  try {
+    if (lua_istable(L, 2) || toExprVector(L, 2)) {
+      z3::expr_vector vec(goal->ctx());
+      checkExprArray(L, 2, vec);
+      goal->add(vec);
+    } else {
+      goal->add(*checkExpr(L, 2));
+    }
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+  return 0;
+}
+
+static int Goal_size(lua_State* L) {
+  auto* goal = checkGoal(L, 1);
+  lua_pushinteger(L, goal->size());
+  return 1;
+}
+
+// Get the i-th formula (1-based)
+static int Goal_formula(lua_State* L) {
+  auto* goal = checkGoal(L, 1);
+  lua_Integer i = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, i >= 1 && i <= static_cast<lua_Integer>(goal->size()), 2,
+                "index out of range");
+  pushExpr(L, (*goal)[static_cast<int>(i - 1)]);
+  return 1;
+}
+
+// Get all formulas as a z3.expr_vector
+static int Goal_formulas(lua_State* L) {
+  auto* goal = checkGoal(L, 1);
+  z3::expr_vector vec(goal->ctx());
+  for (unsigned i = 0; i < goal->size(); ++i) {
+    vec.push_back((*goal)[static_cast<int>(i)]);
+  }
+  pushExprVector(L, vec);
+  return 1;
+}
+
+// Get the conjunction of all formulas
+static int Goal_as_expr(lua_State* L) {
+  auto* goal = checkGoal(L, 1);
+  pushExpr(L, goal->as_expr());
+  return 1;
+}
+
+static int Goal_inconsistent(lua_State* L) {
+  auto* goal = checkGoal(L, 1);
+  lua_pushboolean(L, goal->inconsistent());
+  return 1;
+}
+
+static int Goal_is_decided_sat(lua_State* L) {
+  auto* goal = checkGoal(L, 1);
+  lua_pushboolean(L, goal->is_decided_sat());
+  return 1;
+}
+
+static int Goal_is_decided_unsat(lua_State* L) {
+  auto* goal = checkGoal(L, 1);
+  lua_pushboolean(L, goal->is_decided_unsat());
+  return 1;
+}
+
+static int Goal_depth(lua_State* L) {
+  auto* goal = checkGoal(L, 1);
+  lua_pushinteger(L, goal->depth());
+  return 1;
+}
+
+static int Goal_reset(lua_State* L) {
+  auto* goal = checkGoal(L, 1);
+  goal->reset();
+  return 0;
+}
+
+static int Goal_tostring(lua_State* L) {
+  auto* goal = checkGoal(L, 1);
+  std::ostringstream oss;
+  oss << *goal;
+  lua_pushstring(L, oss.str().c_str());
+  return 1;
+}
+
+// Allocator - requires a context
+static z3::goal* Goal_allocator(lua_State* L) {
+  auto* ctx = luaW_check<z3::context>(L, 1);
+  retainContext(*ctx);
+  return new z3::goal(*ctx);
+}
+
+static void Goal_deallocator(lua_State* L, z3::goal* goal) {
+  z3::context& ctx = goal->ctx();
+  delete goal;
+  releaseContext(ctx);
+}
+
+static luaL_Reg goalTable[] = {
+    {NULL, NULL}
+};
+
+static luaL_Reg goalMetatable[] = {
+    {"add", Goal_add},
+    {"size", Goal_size},
+    {"formula", Goal_formula},
+    {"formulas", Goal_formulas},
+    {"as_expr", Goal_as_expr},
+    {"inconsistent", Goal_inconsistent},
+    {"is_decided_sat", Goal_is_decided_sat},
+    {"is_decided_unsat", Goal_is_decided_unsat},
+    {"depth", Goal_depth},
+    {"reset", Goal_reset},
+    {"__len", Goal_size},
+    {"__tostring", Goal_tostring},
+    {NULL, NULL}
+};
+
+int luaopen_z3_goal(lua_State* L) {
+  LUAZ3_REGISTER_TYPE<z3::goal>(
+      L,
+      "z3.goal",
+      goalTable,
+      goalMetatable,
+      Goal_allocator,
+      Goal_deallocator
+  );
+  return 1;
+}
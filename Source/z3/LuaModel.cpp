@@ -1,4 +1,5 @@
 #include "z3/LuaModel.hpp"
+#include "z3/LuaExpr.hpp"
 
 static z3::model* checkModel(lua_State* L, int index) {
   return luaW_check<z3::model>(L, index);
@@ -7,11 +8,10 @@ static z3::model* checkModel(lua_State* L, int index) {
 // Evaluate an expression in this model
 static int Model_eval(lua_State* L) {
   auto* model = checkModel(L, 1);
-  auto* expr = luaW_check<z3::expr>(L, 2);
+  auto* expr = checkExpr(L, 2);
   bool model_completion = lua_toboolean(L, 3);
   try {
-    auto* result = new z3::expr(model->eval(*expr, model_completion));
-    luaW_push<z3::expr>(L, result);
+    pushExpr(L, model->eval(*expr, model_completion));
     return 1;
   } catch (const z3::exception& e) {
     return luaL_error(L, "z3 error: %s", e.msg());
@@ -44,8 +44,7 @@ static int Model_get_const_decl(lua_State* L) {
   lua_newtable(L);
   lua_pushstring(L, decl.name().str().c_str());
   lua_setfield(L, -2, "name");
-  auto* value = new z3::expr(model->get_const_interp(decl));
-  luaW_push<z3::expr>(L, value);
+  pushExpr(L, model->get_const_interp(decl));
   lua_setfield(L, -2, "value");
   return 1;
 }
@@ -59,8 +58,7 @@ static int Model_consts_iterator(lua_State* L) {
   }
   z3::func_decl decl = model->get_const_decl(index);
   lua_pushstring(L, decl.name().str().c_str());
-  auto* value = new z3::expr(model->get_const_interp(decl));
-  luaW_push<z3::expr>(L, value);
+  pushExpr(L, model->get_const_interp(decl));
   // Update index
   lua_pushinteger(L, index + 1);
   lua_replace(L, lua_upvalueindex(2));
@@ -75,29 +73,72 @@ static int Model_consts(lua_State* L) {
   return 1;
 }
 
+// Push an evaluated expression as a Lua value: a boolean for true/false, an
+// integer for numerals that fit in 64 bits, and a string otherwise
+void pushValue(lua_State* L, const z3::expr& result) {
+  if (result.is_bool()) {
+    if (result.is_true()) {
+      lua_pushboolean(L, 1);
+    } else if (result.is_false()) {
+      lua_pushboolean(L, 0);
+    } else {
+      lua_pushnil(L);
+    }
+  } else if (result.is_int() || result.is_numeral()) {
+    int64_t val;
+    if (result.is_numeral_i64(val)) {
+      lua_pushinteger(L, static_cast<lua_Integer>(val));
+    } else {
+      lua_pushstring(L, result.to_string().c_str());
+    }
+  } else {
+    lua_pushstring(L, result.to_string().c_str());
+  }
+}
+
 // Get the value of a constant as a Lua value (when possible)
 static int Model_get_value(lua_State* L) {
   auto* model = checkModel(L, 1);
-  auto* expr = luaW_check<z3::expr>(L, 2);
+  auto* expr = checkExpr(L, 2);
   try {
-    z3::expr result = model->eval(*expr, true);
-    if (result.is_bool()) {
-      if (result.is_true()) {
-        lua_pushboolean(L, 1);
-      } else if (result.is_false()) {
-        lua_pushboolean(L, 0);
-      } else {
-        lua_pushnil(L);
-      }
-    } else if (result.is_int() || result.is_numeral()) {
-      int64_t val;
-      if (result.is_numeral_i64(val)) {
-        lua_pushinteger(L, static_cast<lua_Integer>(val));
-      } else {
-        lua_pushstring(L, result.to_string().c_str());
-      }
-    } else {
-      lua_pushstring(L, result.to_string().c_str());
+    pushValue(L, model->eval(*expr, true));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// Get the values of an array or z3.expr_vector of expressions as a parallel
+// array of Lua values
+static int Model_get_values(lua_State* L) {
+  auto* model = checkModel(L, 1);
+  z3::expr_vector exprs(model->ctx());
+  checkExprArray(L, 2, exprs);
+  unsigned n = exprs.size();
+  lua_createtable(L, static_cast<int>(n), 0);
+  try {
+    for (unsigned i = 0; i < n; ++i) {
+      pushValue(L, model->eval(exprs[i], true));
+      lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// Get a table mapping the name of every constant in the model to its value,
+// without creating an expression object per constant
+static int Model_to_table(lua_State* L) {
+  auto* model = checkModel(L, 1);
+  try {
+    unsigned n = model->num_consts();
+    lua_createtable(L, 0, static_cast<int>(n));
+    for (unsigned i = 0; i < n; ++i) {
+      z3::func_decl decl = model->get_const_decl(i);
+      lua_pushstring(L, decl.name().str().c_str());
+      pushValue(L, model->get_const_interp(decl));
+      lua_rawset(L, -3);
     }
     return 1;
   } catch (const z3::exception& e) {
@@ -122,6 +163,8 @@ static luaL_Reg modelTable[] = {
 static luaL_Reg modelMetatable[] = {
     {"eval", Model_eval},
     {"get_value", Model_get_value},
+    {"get_values", Model_get_values},
+    {"to_table", Model_to_table},
     {"num_consts", Model_num_consts},
     {"num_funcs", Model_num_funcs},
     {"get_const_decl", Model_get_const_decl},
@@ -0,0 +1,249 @@
+#include "z3/LuaOptimize.hpp"
+#include "z3/LuaContext.hpp"
+#include "z3/LuaExpr.hpp"
+#include "z3/LuaParams.hpp"
+#include "z3/LuaSolver.hpp"
+#include <sstream>
+#include <string>
+
+static z3::optimize* checkOptimize(lua_State* L, int index) {
+  return luaW_check<z3::optimize>(L, index);
+}
+
+// Objectives are identified in Lua by the integer handle Z3 assigns them
+static z3::optimize::handle checkObjective(lua_State* L, int index) {
+  return z3::optimize::handle(static_cast<unsigned>(luaL_checkinteger(L, index)));
+}
+
+// Add a hard constraint, optionally tracked by a literal (or its name)
+static int Optimize_add(lua_State* L) {
+  auto* opt = checkOptimize(L, 1);
+  auto* expr = checkExpr(L, 2);
+  try {
+    if (lua_isnoneornil(L, 3)) {
+      opt->add(*expr);
+    } else if (lua_type(L, 3) == LUA_TSTRING) {
+      opt->add(*expr, lua_tostring(L, 3));
+    } else {
+      opt->add(*expr, *checkExpr(L, 3));
+    }
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+  return 0;
+}
+
+// The weight of a soft constraint as a decimal string. Lua would format
+// numbers with "%.14g", whose exponents Z3 rejects, so they are converted
+// exactly.
+static std::string toWeight(lua_State* L, int index) {
+  if (lua_isnoneornil(L, index)) {
+    return "1";
+  }
+  if (lua_type(L, index) != LUA_TNUMBER) {
+    return lua_tostring(L, index);
+  }
+#if LUA_VERSION_NUM >= 503
+  if (lua_isinteger(L, index)) {
+    return std::to_string(lua_tointeger(L, index));
+  }
+#endif
+  return toDecimalString(lua_tonumber(L, index));
+}
+
+// Add a soft constraint: opt:add_soft(expr[, weight[, group]]). The weight is
+// a number or a decimal string and defaults to 1. Soft constraints with the
+// same group name form one MaxSAT objective. Returns the objective handle.
+static int Optimize_add_soft(lua_State* L) {
+  auto* opt = checkOptimize(L, 1);
+  auto* expr = checkExpr(L, 2);
+  if (!lua_isnoneornil(L, 3) && lua_type(L, 3) != LUA_TNUMBER) {
+    luaL_checkstring(L, 3);
+  }
+  const char* group = luaL_optstring(L, 4, nullptr);
+  try {
+    std::string weight = toWeight(L, 3);
+    z3::context& ctx = opt->ctx();
+    Z3_symbol id = group ? Z3_mk_string_symbol(ctx, group) : nullptr;
+    unsigned h =
+        Z3_optimize_assert_soft(ctx, *opt, *expr, weight.c_str(), id);
+    ctx.check_error();
+    lua_pushinteger(L, h);
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// Add an objective to minimize; returns its handle for lower/upper
+static int Optimize_minimize(lua_State* L) {
+  auto* opt = checkOptimize(L, 1);
+  auto* expr = checkExpr(L, 2);
+  try {
+    lua_pushinteger(L, opt->minimize(*expr).h());
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// Add an objective to maximize; returns its handle for lower/upper
+static int Optimize_maximize(lua_State* L) {
+  auto* opt = checkOptimize(L, 1);
+  auto* expr = checkExpr(L, 2);
+  try {
+    lua_pushinteger(L, opt->maximize(*expr).h());
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// Check and optimize, optionally under an array of assumptions
+static int Optimize_check(lua_State* L) {
+  auto* opt = checkOptimize(L, 1);
+  z3::expr_vector assumptions(opt->ctx());
+  if (!lua_isnoneornil(L, 2)) {
+    checkExprArray(L, 2, assumptions);
+  }
+  try {
+    pushCheckResult(L, assumptions.empty() ? opt->check() : opt->check(assumptions));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// Get the optimal model (only valid after check() returns sat)
+static int Optimize_get_model(lua_State* L) {
+  auto* opt = checkOptimize(L, 1);
+  try {
+    auto* model = new z3::model(opt->get_model());
+    luaW_push<z3::model>(L, model);
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// Lower bound of an objective after check
+static int Optimize_lower(lua_State* L) {
+  auto* opt = checkOptimize(L, 1);
+  try {
+    pushExpr(L, opt->lower(checkObjective(L, 2)));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// Upper bound of an objective after check
+static int Optimize_upper(lua_State* L) {
+  auto* opt = checkOptimize(L, 1);
+  try {
+    pushExpr(L, opt->upper(checkObjective(L, 2)));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+static int Optimize_push(lua_State* L) {
+  auto* opt = checkOptimize(L, 1);
+  opt->push();
+  return 0;
+}
+
+static int Optimize_pop(lua_State* L) {
+  auto* opt = checkOptimize(L, 1);
+  opt->pop();
+  return 0;
+}
+
+// Set optimizer parameters from a table (see solver:set)
+static int Optimize_set(lua_State* L) {
+  auto* opt = checkOptimize(L, 1);
+  z3::params params = checkParams(L, 2, opt->ctx());
+  try {
+    opt->set(params);
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+  return 0;
+}
+
+static int Optimize_unsat_core(lua_State* L) {
+  auto* opt = checkOptimize(L, 1);
+  try {
+    z3::expr_vector core = opt->unsat_core();
+    lua_createtable(L, static_cast<int>(core.size()), 0);
+    for (unsigned i = 0; i < core.size(); ++i) {
+      pushExpr(L, core[i]);
+      lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+static int Optimize_reason_unknown(lua_State* L) {
+  auto* opt = checkOptimize(L, 1);
+  lua_pushstring(L, Z3_optimize_get_reason_unknown(opt->ctx(), *opt));
+  return 1;
+}
+
+static int Optimize_tostring(lua_State* L) {
+  auto* opt = checkOptimize(L, 1);
+  std::ostringstream oss;
+  oss << *opt;
+  lua_pushstring(L, oss.str().c_str());
+  return 1;
+}
+
+// Allocator - requires a context
+static z3::optimize* Optimize_allocator(lua_State* L) {
+  auto* ctx = luaW_check<z3::context>(L, 1);
+  retainContext(*ctx);
+  return new z3::optimize(*ctx);
+}
+
+static void Optimize_deallocator(lua_State* L, z3::optimize* opt) {
+  z3::context& ctx = opt->ctx();
+  delete opt;
+  releaseContext(ctx);
+}
+
+static luaL_Reg optimizeTable[] = {
+    {NULL, NULL}
+};
+
+static luaL_Reg optimizeMetatable[] = {
+    {"add", Optimize_add},
+    {"add_soft", Optimize_add_soft},
+    {"minimize", Optimize_minimize},
+    {"maximize", Optimize_maximize},
+    {"set", Optimize_set},
+    {"check", Optimize_check},
+    {"get_model", Optimize_get_model},
+    {"lower", Optimize_lower},
+    {"upper", Optimize_upper},
+    {"push", Optimize_push},
+    {"pop", Optimize_pop},
+    {"unsat_core", Optimize_unsat_core},
+    {"reason_unknown", Optimize_reason_unknown},
+    {"__tostring", Optimize_tostring},
+    {NULL, NULL}
+};
+
+int luaopen_z3_optimize(lua_State* L) {
+  LUAZ3_REGISTER_TYPE<z3::optimize>(
+      L,
+      "z3.optimize",
+      optimizeTable,
+      optimizeMetatable,
+      Optimize_allocator,
+      Optimize_deallocator
+  );
+  return 1;
+}
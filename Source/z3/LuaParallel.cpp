@@ -0,0 +1,435 @@
+#include "z3/LuaParallel.hpp"
+#include "z3/LuaExpr.hpp"
+#include "z3/LuaExprVector.hpp"
+#include "z3/LuaParams.hpp"
+#include "z3/LuaSolver.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Collect the problem to solve from a z3.solver, a z3.expr_vector of
+// assertions (as returned by solver:assertions()) or an array of them. For a
+// solver, params receives its solver:set parameters, which the solvers built
+// from it start out with.
+static z3::expr_vector checkProblem(lua_State* L, int index,
+                                    ParamList& params) {
+  if (auto* vec = toExprVector(L, index)) {
+    return *vec;
+  }
+  if (!lua_istable(L, index)) {
+    auto* solver = static_cast<LuaSolver*>(luaW_check<z3::solver>(L, index));
+    params = solver->params;
+    return solver->assertions();
+  }
+  int n = static_cast<int>(lua_rawlen(L, index));
+  if (n == 0) {
+    luaL_argerror(L, index, "expected a solver or a non-empty array of assertions");
+  }
+  lua_rawgeti(L, index, 1);
+  z3::expr_vector assertions(checkExpr(L, -1)->ctx());
+  lua_pop(L, 1);
+  checkExprArray(L, index, assertions);
+  return assertions;
+}
+
+// One solver of a race, with the context it owns.
+struct RaceEntry {
+  explicit RaceEntry(const z3::expr_vector& assertions)
+      : solver(ctx) {
+    z3::expr_vector local(ctx, assertions);
+    for (unsigned i = 0; i < local.size(); ++i) {
+      solver.add(local[i]);
+    }
+  }
+
+  z3::context ctx;
+  z3::solver solver;
+  z3::check_result result = z3::unknown;
+  std::string error;
+};
+
+// Run every entry on its own thread until one reaches a definitive result,
+// then interrupt the rest. Returns the index of the winner, or -1.
+static int race(std::vector<std::unique_ptr<RaceEntry>>& entries) {
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t finished = 0;
+  std::vector<bool> done(entries.size());
+  int winner = -1;
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    workers.emplace_back([&, i] {
+      RaceEntry& entry = *entries[i];
+      try {
+        entry.result = entry.solver.check();
+      } catch (const z3::exception& e) {
+        entry.error = e.msg();
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      if (winner < 0 && entry.result != z3::unknown) {
+        winner = static_cast<int>(i);
+      }
+      done[i] = true;
+      ++finished;
+      cv.notify_all();
+    });
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  cv.wait(lock, [&] { return winner >= 0 || finished == entries.size(); });
+  // An interrupt that arrives before a worker has entered check can be lost,
+  // so keep interrupting until every worker has returned. Finished entries
+  // are left alone: an interrupted context fails every later call, including
+  // reading the winner's model.
+  while (finished < entries.size()) {
+    for (size_t i = 0; i < entries.size(); ++i) {
+      if (!done[i]) {
+        entries[i]->ctx.interrupt();
+      }
+    }
+    cv.wait_for(lock, std::chrono::milliseconds(10));
+  }
+  lock.unlock();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  return winner;
+}
+
+// Push a z3 error message, to be raised with lua_error once the C++ objects
+// it came from are destroyed. Returns -1.
+static int pushZ3Error(lua_State* L, const char* msg) {
+  lua_pushfstring(L, "z3 error: %s", msg);
+  return -1;
+}
+
+// The body of z3.portfolio, called with every config validated. Besides
+// reading the problem, which happens before any context exists, it never
+// raises, so the contexts and solvers it creates are always destroyed.
+// Returns the number of results, or -1 with an error message pushed.
+static int portfolio(lua_State* L, int n) {
+  ParamList base;
+  z3::expr_vector assertions = checkProblem(L, 1, base);
+  std::vector<ParamList> configs;
+  for (int i = 1; i <= n; ++i) {
+    lua_rawgeti(L, 2, i);
+    configs.push_back(base);
+    mergeParams(configs.back(), toParamList(L, -1));
+    lua_pop(L, 1);
+  }
+
+  std::vector<std::unique_ptr<RaceEntry>> entries;
+  try {
+    for (const ParamList& config : configs) {
+      entries.push_back(std::make_unique<RaceEntry>(assertions));
+      z3::params params(entries.back()->ctx);
+      applyParams(config, params);
+      entries.back()->solver.set(params);
+    }
+  } catch (const z3::exception& e) {
+    return pushZ3Error(L, e.msg());
+  }
+
+  int winner = race(entries);
+  if (winner < 0) {
+    for (auto& entry : entries) {
+      if (entry->error.empty()) {
+        lua_pushstring(L, "unknown");
+        return 1;
+      }
+    }
+    return pushZ3Error(L, entries.front()->error.c_str());
+  }
+
+  RaceEntry& best = *entries[winner];
+  pushCheckResult(L, best.result);
+  lua_rawgeti(L, 2, winner + 1);
+  if (best.result != z3::sat) {
+    return 2;
+  }
+  try {
+    z3::model model = best.solver.get_model();
+    auto* result = new z3::model(model, assertions.ctx(), z3::model::translate());
+    luaW_push<z3::model>(L, result);
+    return 3;
+  } catch (const z3::exception& e) {
+    return pushZ3Error(L, e.msg());
+  }
+}
+
+// z3.portfolio(solver_or_assertions, configs)
+//
+// Solve the same problem with one differently configured solver per config
+// (a table of solver parameters, see solver:set), each on its own thread.
+// Given a solver, each config is applied on top of its solver:set parameters.
+// Returns the first definitive result, the winning config table and, when
+// sat, the model translated back into the problem's context.
+int z3_portfolio(lua_State* L) {
+  luaL_checktype(L, 2, LUA_TTABLE);
+  int n = static_cast<int>(lua_rawlen(L, 2));
+  luaL_argcheck(L, n > 0, 2, "expected at least one config");
+  for (int i = 1; i <= n; ++i) {
+    lua_rawgeti(L, 2, i);
+    checkParamTable(L, -1);
+    lua_pop(L, 1);
+  }
+  int results = portfolio(L, n);
+  return results < 0 ? lua_error(L) : results;
+}
+
+// One worker of a cube-and-conquer run. It owns a context with its own copy
+// of the problem and of every cube, so it can pick any cube off the queue.
+struct CubeWorker {
+  CubeWorker(const z3::expr_vector& assertions,
+             const std::vector<z3::expr_vector>& all_cubes)
+      : solver(ctx) {
+    z3::expr_vector local(ctx, assertions);
+    for (unsigned i = 0; i < local.size(); ++i) {
+      solver.add(local[i]);
+    }
+    for (const auto& cube : all_cubes) {
+      cubes.emplace_back(ctx, cube);
+    }
+  }
+
+  // The part of the search space no cube covers: the problem with every
+  // cube excluded.
+  z3::check_result checkRemainder() {
+    solver.push();
+    z3::check_result result = z3::unknown;
+    try {
+      for (const auto& cube : cubes) {
+        solver.add(!z3::mk_and(cube));
+      }
+      result = solver.check();
+    } catch (const z3::exception&) {
+      solver.pop();
+      throw;
+    }
+    // Keep the scope on sat so the caller can still read the model.
+    if (result != z3::sat) {
+      solver.pop();
+    }
+    return result;
+  }
+
+  z3::context ctx;
+  z3::solver solver;
+  std::vector<z3::expr_vector> cubes;
+  std::unique_ptr<z3::model> model;
+  std::string error;
+};
+
+// Solve the cubes on one thread per worker. Jobs are the cube indices, plus
+// one extra job for the remainder when cube generation was cut short. Stops
+// at the first sat cube and interrupts the other workers.
+static z3::check_result conquer(
+    std::vector<std::unique_ptr<CubeWorker>>& workers, size_t jobs,
+    int& winner) {
+  std::atomic<size_t> next{0};
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t finished = 0;
+  std::vector<bool> done(workers.size());
+  bool unknown = false;
+  winner = -1;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < workers.size(); ++i) {
+    threads.emplace_back([&, i] {
+      CubeWorker& worker = *workers[i];
+      for (;;) {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (winner >= 0) {
+            break;
+          }
+        }
+        size_t job = next++;
+        if (job >= jobs) {
+          break;
+        }
+        z3::check_result result = z3::unknown;
+        try {
+          result = job < worker.cubes.size()
+                       ? worker.solver.check(worker.cubes[job])
+                       : worker.checkRemainder();
+          if (result == z3::sat) {
+            worker.model = std::make_unique<z3::model>(worker.solver.get_model());
+          }
+        } catch (const z3::exception& e) {
+          worker.error = e.msg();
+          result = z3::unknown;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (result == z3::sat) {
+          if (winner < 0) {
+            winner = static_cast<int>(i);
+          }
+          cv.notify_all();
+          break;
+        }
+        if (result == z3::unknown) {
+          unknown = true;
+        }
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      done[i] = true;
+      ++finished;
+      cv.notify_all();
+    });
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  cv.wait(lock, [&] { return winner >= 0 || finished == workers.size(); });
+  // As in race, only interrupt workers that are still running; the winner's
+  // context is needed to translate its model.
+  while (finished < workers.size()) {
+    for (size_t i = 0; i < workers.size(); ++i) {
+      if (!done[i]) {
+        workers[i]->ctx.interrupt();
+      }
+    }
+    cv.wait_for(lock, std::chrono::milliseconds(10));
+  }
+  lock.unlock();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  if (winner >= 0) {
+    return z3::sat;
+  }
+  return unknown ? z3::unknown : z3::unsat;
+}
+
+// The body of z3.cube_and_conquer, called with the options validated and the
+// parameter tables (0 when absent) on the stack. Like portfolio, it raises
+// only while reading the problem, before any context exists. Returns the
+// number of results, or -1 with an error message pushed.
+static int cubeAndConquer(lua_State* L, unsigned threads,
+                          lua_Integer max_cubes, int params,
+                          int split_params) {
+  ParamList worker_params;
+  z3::expr_vector assertions = checkProblem(L, 1, worker_params);
+  z3::context& ctx = assertions.ctx();
+  if (params) {
+    mergeParams(worker_params, toParamList(L, params));
+  }
+  ParamList splitter_params =
+      split_params ? toParamList(L, split_params) : ParamList();
+
+  // Split
+  std::vector<z3::expr_vector> cubes;
+  bool truncated = false;
+  try {
+    z3::solver splitter(ctx);
+    z3::params settings(ctx);
+    applyParams(splitter_params, settings);
+    splitter.set(settings);
+    splitter.add(assertions);
+    z3::expr_vector vars(ctx);
+    for (;;) {
+      if (static_cast<lua_Integer>(cubes.size()) >= max_cubes) {
+        truncated = true;
+        break;
+      }
+      z3::expr_vector cube = splitter.cube(vars, UINT_MAX);
+      if (cube.size() == 1 && cube[0].is_false()) {
+        break;
+      }
+      cubes.push_back(cube);
+      if (cube.empty()) {
+        break;
+      }
+    }
+  } catch (const z3::exception& e) {
+    return pushZ3Error(L, e.msg());
+  }
+  size_t jobs = cubes.size() + (truncated ? 1 : 0);
+  if (jobs == 0) {
+    lua_pushstring(L, "unsat");
+    return 1;
+  }
+
+  // Conquer
+  std::vector<std::unique_ptr<CubeWorker>> workers;
+  try {
+    for (size_t i = 0; i < std::min<size_t>(threads, jobs); ++i) {
+      workers.push_back(std::make_unique<CubeWorker>(assertions, cubes));
+      z3::params settings(workers.back()->ctx);
+      applyParams(worker_params, settings);
+      workers.back()->solver.set(settings);
+    }
+  } catch (const z3::exception& e) {
+    return pushZ3Error(L, e.msg());
+  }
+  int winner;
+  z3::check_result result = conquer(workers, jobs, winner);
+  if (result == z3::unknown) {
+    for (auto& worker : workers) {
+      if (!worker->error.empty()) {
+        return pushZ3Error(L, worker->error.c_str());
+      }
+    }
+  }
+  pushCheckResult(L, result);
+  if (result != z3::sat) {
+    return 1;
+  }
+  try {
+    auto* model = new z3::model(*workers[winner]->model, ctx,
+                                z3::model::translate());
+    luaW_push<z3::model>(L, model);
+    return 2;
+  } catch (const z3::exception& e) {
+    return pushZ3Error(L, e.msg());
+  }
+}
+
+// z3.cube_and_conquer(solver_or_assertions[, options])
+//
+// Split the problem into cubes with lookahead (on the calling thread, in the
+// problem's context), then solve the cubes on a pool of worker threads, each
+// with a private translated copy of the problem. Options:
+//   threads      number of workers (default: hardware concurrency)
+//   max_cubes    stop splitting after this many cubes (default 8 per thread);
+//                the rest of the search space is then solved as one job
+//   params       solver parameters for the workers, on top of those set on
+//                the solver when one is given
+//   split_params solver parameters for the splitting solver
+// Returns "sat", "unsat" or "unknown", and when sat the model translated back
+// into the problem's context.
+int z3_cube_and_conquer(lua_State* L) {
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  lua_Integer max_cubes = 0;
+  int params = 0;
+  int split_params = 0;
+  if (!lua_isnoneornil(L, 2)) {
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_getfield(L, 2, "threads");
+    lua_Integer n = luaL_optinteger(L, -1, threads);
+    luaL_argcheck(L, n > 0, 2, "threads must be positive");
+    threads = static_cast<unsigned>(n);
+    lua_getfield(L, 2, "max_cubes");
+    max_cubes = luaL_optinteger(L, -1, 0);
+    lua_getfield(L, 2, "params");
+    if (!lua_isnil(L, -1)) {
+      checkParamTable(L, -1);
+      params = lua_gettop(L);
+    }
+    lua_getfield(L, 2, "split_params");
+    if (!lua_isnil(L, -1)) {
+      checkParamTable(L, -1);
+      split_params = lua_gettop(L);
+    }
+  }
+  if (max_cubes <= 0) {
+    max_cubes = 8 * static_cast<lua_Integer>(threads);
+  }
+  int results = cubeAndConquer(L, threads, max_cubes, params, split_params);
+  return results < 0 ? lua_error(L) : results;
+}
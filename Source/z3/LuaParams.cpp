@@ -0,0 +1,111 @@
+#include "z3/LuaParams.hpp"
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+// Whether a Lua number is stored as an unsigned parameter
+static bool isUnsigned(lua_Number val) {
+  return val >= 0 && val <= UINT_MAX && std::floor(val) == val;
+}
+
+void checkParamTable(lua_State* L, int index) {
+  index = lua_absindex(L, index);
+  luaL_checktype(L, index, LUA_TTABLE);
+  lua_pushnil(L);
+  while (lua_next(L, index) != 0) {
+    if (lua_type(L, -2) != LUA_TSTRING) {
+      luaL_error(L, "parameter names must be strings");
+    }
+    int type = lua_type(L, -1);
+    if (type != LUA_TBOOLEAN && type != LUA_TNUMBER && type != LUA_TSTRING) {
+      luaL_error(L, "parameter '%s' has unsupported type %s",
+                 lua_tostring(L, -2), luaL_typename(L, -1));
+    }
+    lua_pop(L, 1);
+  }
+}
+
+ParamList toParamList(lua_State* L, int index) {
+  index = lua_absindex(L, index);
+  ParamList list;
+  lua_pushnil(L);
+  while (lua_next(L, index) != 0) {
+    Param param;
+    param.name = lua_tostring(L, -2);
+    if (param.name == "timeout_ms") {
+      param.name = "timeout";
+    }
+    switch (lua_type(L, -1)) {
+      case LUA_TBOOLEAN:
+        param.kind = Param::kBool;
+        param.bool_value = lua_toboolean(L, -1);
+        break;
+      case LUA_TNUMBER: {
+        lua_Number val = lua_tonumber(L, -1);
+        if (isUnsigned(val)) {
+          param.kind = Param::kUnsigned;
+          param.uint_value = static_cast<unsigned>(val);
+        } else {
+          param.kind = Param::kDouble;
+          param.double_value = static_cast<double>(val);
+        }
+        break;
+      }
+      default:
+        param.kind = Param::kSymbol;
+        param.symbol_value = lua_tostring(L, -1);
+        break;
+    }
+    list.push_back(std::move(param));
+    lua_pop(L, 1);
+  }
+  return list;
+}
+
+void applyParams(const ParamList& list, z3::params& params) {
+  for (const Param& param : list) {
+    const char* name = param.name.c_str();
+    switch (param.kind) {
+      case Param::kBool:
+        params.set(name, param.bool_value);
+        break;
+      case Param::kUnsigned:
+        params.set(name, param.uint_value);
+        break;
+      case Param::kDouble:
+        params.set(name, param.double_value);
+        break;
+      case Param::kSymbol:
+        params.set(name, param.symbol_value.c_str());
+        break;
+    }
+  }
+}
+
+void mergeParams(ParamList& into, const ParamList& from) {
+  for (const Param& param : from) {
+    bool replaced = false;
+    for (Param& existing : into) {
+      if (existing.name == param.name) {
+        existing = param;
+        replaced = true;
+      }
+    }
+    if (!replaced) {
+      into.push_back(param);
+    }
+  }
+}
+
+void setParams(lua_State* L, int index, z3::params& params) {
+  checkParamTable(L, index);
+  applyParams(toParamList(L, index), params);
+}
+
+z3::params checkParams(lua_State* L, int index, z3::context& ctx) {
+  checkParamTable(L, index);
+  z3::params params(ctx);
+  applyParams(toParamList(L, index), params);
+  return params;
+}
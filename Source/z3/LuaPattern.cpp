@@ -0,0 +1,50 @@
+#include "z3/LuaPattern.hpp"
+#include "z3/LuaContext.hpp"
+
+z3::ast* checkPattern(lua_State* L, int index) {
+  return luaW_check<z3::ast>(L, index);
+}
+
+z3::ast* toPattern(lua_State* L, int index) {
+  return luaW_to<z3::ast>(L, index);
+}
+
+void pushPattern(lua_State* L, const z3::ast& pattern) {
+  auto* copy = new z3::ast(pattern);
+  retainContext(copy->ctx());
+  luaW_push<z3::ast>(L, copy);
+  luaW_hold<z3::ast>(L, copy);
+}
+
+static int Pattern_tostring(lua_State* L) {
+  auto* pattern = checkPattern(L, 1);
+  lua_pushstring(L, pattern->to_string().c_str());
+  return 1;
+}
+
+static void Pattern_deallocator(lua_State* L, z3::ast* pattern) {
+  z3::context& ctx = pattern->ctx();
+  delete pattern;
+  releaseContext(ctx);
+}
+
+static luaL_Reg patternTable[] = {
+    {NULL, NULL}
+};
+
+static luaL_Reg patternMetatable[] = {
+    {"__tostring", Pattern_tostring},
+    {NULL, NULL}
+};
+
+int luaopen_z3_pattern(lua_State* L) {
+  LUAZ3_REGISTER_TYPE<z3::ast>(
+      L,
+      "z3.pattern",
+      patternTable,
+      patternMetatable,
+      nullptr,
+      Pattern_deallocator
+  );
+  return 1;
+}
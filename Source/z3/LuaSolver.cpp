@@ -1,22 +1,20 @@
 #include "z3/LuaSolver.hpp"
+#include "z3/LuaCheckHandle.hpp"
+#include "z3/LuaContext.hpp"
+#include "z3/LuaExpr.hpp"
+#include "z3/LuaExprVector.hpp"
+#include "z3/LuaModel.hpp"
+#include "z3/LuaParams.hpp"
+#include <chrono>
+#include <climits>
+#include <cstring>
 #include <sstream>
 
-static z3::solver* checkSolver(lua_State* L, int index) {
-  return luaW_check<z3::solver>(L, index);
+static LuaSolver* checkSolver(lua_State* L, int index) {
+  return static_cast<LuaSolver*>(luaW_check<z3::solver>(L, index));
 }
 
-// Add an assertion to the solver
-static int Solver_add(lua_State* L) {
-  auto* solver = checkSolver(L, 1);
-  auto* expr = luaW_check<z3::expr>(L, 2);
-  solver->add(*expr);
-  return 0;
-}
-
-// Check satisfiability
-static int Solver_check(lua_State* L) {
-  auto* solver = checkSolver(L, 1);
-  z3::check_result result = solver->check();
+void pushCheckResult(lua_State* L, z3::check_result result) {
   switch (result) {
     case z3::sat:
       lua_pushstring(L, "sat");
@@ -28,9 +26,202 @@ static int Solver_check(lua_State* L) {
       lua_pushstring(L, "unknown");
       break;
   }
+}
+
+// Set solver parameters, e.g. solver:set{timeout = 1000, ["smt.arith.solver"] = 2}
+static int Solver_set(lua_State* L) {
+  auto* solver = checkSolver(L, 1);
+  z3::params params = checkParams(L, 2, solver->ctx());
+  try {
+    solver->set(params);
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+  // Remember what was set so per-check limits can be rolled back onto it.
+  mergeParams(solver->params, toParamList(L, 2));
+  return 0;
+}
+
+// Add an assertion to the solver. An optional tracking literal (a Boolean
+// constant or its name) makes the assertion show up in unsat_core(). A
+// z3.expr_vector adds all of its elements.
+static int Solver_add(lua_State* L) {
+  auto* solver = checkSolver(L, 1);
+  if (auto* vec = toExprVector(L, 2)) {
+    try {
+      solver->add(*vec);
+    } catch (const z3::exception& e) {
+      return luaL_error(L, "z3 error: %s", e.msg());
+    }
+    if (solver->instrumented) {
+      ++solver->metrics.adds;
+    }
+    return 0;
+  }
+  auto* expr = checkExpr(L, 2);
+  try {
+    if (lua_isnoneornil(L, 3)) {
+      solver->add(*expr);
+    } else if (lua_type(L, 3) == LUA_TSTRING) {
+      solver->add(*expr, lua_tostring(L, 3));
+    } else {
+      solver->add(*expr, *checkExpr(L, 3));
+    }
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+  if (solver->instrumented) {
+    ++solver->metrics.adds;
+  }
+  return 0;
+}
+
+// Options accepted by a single check. Anything else is persistent
+// configuration and belongs in solver:set.
+static const char* const kCheckOptions[] = {"timeout", "timeout_ms", "rlimit"};
+
+static void checkCheckOptions(lua_State* L, int index) {
+  lua_pushnil(L);
+  while (lua_next(L, index) != 0) {
+    const char* name = lua_type(L, -2) == LUA_TSTRING ? lua_tostring(L, -2) : "?";
+    bool known = false;
+    for (const char* option : kCheckOptions) {
+      known = known || std::strcmp(name, option) == 0;
+    }
+    if (!known) {
+      luaL_error(L, "unsupported check option '%s' (use solver:set)", name);
+    }
+    lua_pop(L, 1);
+  }
+}
+
+// Collect an optional array or z3.expr_vector of assumption literals at index
+// into vec and return the stack index where the limits table of a check call
+// would be. When both are given the first is always the assumptions, even
+// an empty table; a lone table is the assumptions only if it is non-empty.
+static int checkAssumptions(lua_State* L, int index, z3::expr_vector& vec) {
+  int top = lua_gettop(L);
+  if (top > index + 1) {
+    luaL_argerror(L, index + 2, "expected at most assumptions and limits");
+  }
+  if (top == index + 1) {
+    if (!lua_isnil(L, index)) {
+      checkExprArray(L, index, vec);
+    }
+    return index + 1;
+  }
+  bool is_array = lua_istable(L, index) && lua_rawlen(L, index) > 0;
+  if (!is_array && toExprVector(L, index) == nullptr) {
+    return index;
+  }
+  checkExprArray(L, index, vec);
+  return index + 1;
+}
+
+// Applies the limits of a bounded check and lifts them again, re-applying
+// the solver:set parameters, when it goes out of scope. That also happens
+// when the check throws, before the error reaches Lua.
+struct ScopedLimits {
+  ScopedLimits(LuaSolver& solver, const z3::params* limits)
+      : solver(solver), active(limits != nullptr) {
+    if (active) {
+      solver.set(*limits);
+    }
+  }
+
+  ~ScopedLimits() {
+    if (!active) {
+      return;
+    }
+    try {
+      z3::params unlimited(solver.ctx());
+      unlimited.set("timeout", static_cast<unsigned>(UINT_MAX));
+      unlimited.set("rlimit", 0u);
+      solver.set(unlimited);
+      z3::params settings(solver.ctx());
+      applyParams(solver.params, settings);
+      solver.set(settings);
+    } catch (const z3::exception&) {
+      // Nothing sensible to do; the original error, if any, is reported.
+    }
+  }
+
+  LuaSolver& solver;
+  bool active;
+};
+
+// Check satisfiability. An array of Boolean literals is assumed true for this
+// call only, which lets one long-lived solver answer many related queries
+// without push/pop; unsat_core() then names the assumptions that conflict.
+// A table of limits bounds this call only:
+// solver:check{timeout_ms = 500, rlimit = 1000000}. When a limit is hit the
+// result is "unknown" and reason_unknown() says why.
+static int Solver_check(lua_State* L) {
+  auto* solver = checkSolver(L, 1);
+  z3::expr_vector assumptions(solver->ctx());
+  int options = checkAssumptions(L, 2, assumptions);
+  bool bounded = !lua_isnoneornil(L, options);
+  z3::params limits(solver->ctx());
+  if (bounded) {
+    luaL_checktype(L, options, LUA_TTABLE);
+    checkCheckOptions(L, options);
+    setParams(L, options, limits);
+  }
+  try {
+    ScopedLimits scoped(*solver, bounded ? &limits : nullptr);
+    auto start = std::chrono::steady_clock::now();
+    z3::check_result result = assumptions.empty() ? solver->check()
+                                                  : solver->check(assumptions);
+    if (solver->instrumented) {
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      auto& metrics = solver->metrics;
+      ++metrics.checks;
+      metrics.check_seconds += elapsed.count();
+      metrics.last_check_seconds = elapsed.count();
+      if (elapsed.count() > metrics.max_check_seconds) {
+        metrics.max_check_seconds = elapsed.count();
+      }
+    }
+    pushCheckResult(L, result);
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// Start a check on a worker thread and return a z3.check_handle right away.
+// Takes the same arguments as check. The worker solves a translated copy in a
+// context of its own, so this solver and its context stay usable meanwhile.
+static int Solver_check_async(lua_State* L) {
+  auto* solver = checkSolver(L, 1);
+  z3::expr_vector assumptions(solver->ctx());
+  int options = checkAssumptions(L, 2, assumptions);
+  if (!lua_isnoneornil(L, options)) {
+    luaL_checktype(L, options, LUA_TTABLE);
+    checkCheckOptions(L, options);
+  }
+  pushCheckHandle(L, *solver, assumptions, options);
   return 1;
 }
 
+// Get the assumptions and tracking literals used to prove unsat (only valid
+// after check() returns unsat)
+static int Solver_unsat_core(lua_State* L) {
+  auto* solver = checkSolver(L, 1);
+  try {
+    z3::expr_vector core = solver->unsat_core();
+    lua_createtable(L, static_cast<int>(core.size()), 0);
+    for (unsigned i = 0; i < core.size(); ++i) {
+      pushExpr(L, core[i]);
+      lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
 // Get the model (only valid after check() returns sat)
 static int Solver_get_model(lua_State* L) {
   auto* solver = checkSolver(L, 1);
@@ -65,16 +256,10 @@ static int Solver_pop(lua_State* L) {
   return 0;
 }
 
-// Get assertions
+// Get assertions as a z3.expr_vector
 static int Solver_assertions(lua_State* L) {
   auto* solver = checkSolver(L, 1);
-  z3::expr_vector assertions = solver->assertions();
-  lua_newtable(L);
-  for (unsigned i = 0; i < assertions.size(); ++i) {
-    auto* expr = new z3::expr(assertions[i]);
-    luaW_push<z3::expr>(L, expr);
-    lua_rawseti(L, -2, i + 1);
-  }
+  pushExprVector(L, solver->assertions());
   return 1;
 }
 
@@ -85,16 +270,201 @@ static int Solver_reason_unknown(lua_State* L) {
   return 1;
 }
 
-// Get solver statistics
+// Enumerate models: solver:all_models(vars[, limit[, projection]]). Returns an
+// array of value tuples, one per model, each holding the values of vars in
+// order, followed by "unsat" when the enumeration is exhausted, "limit" when
+// limit models were found, or "unknown" when a check gave up. After each
+// model a blocking clause over the projection (vars by default) is added, so
+// models are distinct on the projected variables. The blocking clauses live
+// in a pushed scope and are removed before returning.
+static int Solver_all_models(lua_State* L) {
+  auto* solver = checkSolver(L, 1);
+  z3::context& ctx = solver->ctx();
+  z3::expr_vector vars(ctx);
+  checkExprArray(L, 2, vars);
+  lua_Integer limit = luaL_optinteger(L, 3, 0);
+  z3::expr_vector projection(ctx);
+  if (lua_isnoneornil(L, 4)) {
+    projection = vars;
+  } else {
+    checkExprArray(L, 4, projection);
+  }
+
+  lua_newtable(L);
+  int models = lua_gettop(L);
+  lua_Integer count = 0;
+  const char* status = "unsat";
+  try {
+    solver->push();
+    try {
+      z3::expr_vector block(ctx);
+      while (limit <= 0 || count < limit) {
+        z3::check_result result = solver->check();
+        if (result != z3::sat) {
+          status = result == z3::unsat ? "unsat" : "unknown";
+          break;
+        }
+        z3::model model = solver->get_model();
+        lua_createtable(L, static_cast<int>(vars.size()), 0);
+        for (unsigned i = 0; i < vars.size(); ++i) {
+          pushValue(L, model.eval(vars[i], true));
+          lua_rawseti(L, -2, i + 1);
+        }
+        lua_rawseti(L, models, ++count);
+
+        block.resize(0);
+        for (unsigned i = 0; i < projection.size(); ++i) {
+          block.push_back(projection[i] != model.eval(projection[i], true));
+        }
+        if (block.empty()) {
+          // Nothing to distinguish further models by
+          break;
+        }
+        solver->add(z3::mk_or(block));
+      }
+      if (limit > 0 && count == limit) {
+        status = "limit";
+      }
+    } catch (const z3::exception&) {
+      solver->pop();
+      throw;
+    }
+    solver->pop();
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+  lua_pushstring(L, status);
+  return 2;
+}
+
+static int Solver_cubes_iterator(lua_State* L) {
+  if (lua_toboolean(L, lua_upvalueindex(4))) {
+    return 0;
+  }
+  auto* solver = checkSolver(L, lua_upvalueindex(1));
+  auto* vars = checkExprVector(L, lua_upvalueindex(2));
+  auto cutoff = static_cast<unsigned>(lua_tointeger(L, lua_upvalueindex(3)));
+  try {
+    z3::expr_vector cube = solver->cube(*vars, cutoff);
+    // The cutoff only bounds the first cube; later cubes use Z3's default.
+    lua_pushinteger(L, UINT_MAX);
+    lua_replace(L, lua_upvalueindex(3));
+    if (cube.size() == 1 && cube[0].is_false()) {
+      lua_pushboolean(L, 1);
+      lua_replace(L, lua_upvalueindex(4));
+      return 0;
+    }
+    if (cube.empty()) {
+      // The problem could not be split further; this is the last cube.
+      lua_pushboolean(L, 1);
+      lua_replace(L, lua_upvalueindex(4));
+    }
+    pushExprVector(L, cube);
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// Iterate over cubes: for cube in solver:cubes([vars[, cutoff]]). Each cube is
+// a z3.expr_vector of literals; together the cubes cover the search space, so
+// the problem is unsat exactly when every cube is. An empty cube means the
+// problem was not split. vars restricts splitting to the given variables.
+// Cubing puts the solver into lookahead mode, so use a dedicated solver.
+static int Solver_cubes(lua_State* L) {
+  auto* solver = checkSolver(L, 1);
+  z3::expr_vector vars(solver->ctx());
+  if (!lua_isnoneornil(L, 2)) {
+    checkExprArray(L, 2, vars);
+  }
+  lua_Integer cutoff = luaL_optinteger(L, 3, UINT_MAX);
+  lua_pushvalue(L, 1);
+  pushExprVector(L, vars);
+  lua_pushinteger(L, cutoff);
+  lua_pushboolean(L, 0);
+  lua_pushcclosure(L, Solver_cubes_iterator, 4);
+  return 1;
+}
+
+// Get solver statistics as a table keyed by statistic name. Counters are
+// integers, everything else (time, memory) is a float.
 static int Solver_statistics(lua_State* L) {
   auto* solver = checkSolver(L, 1);
-  z3::stats stats = solver->statistics();
-  std::ostringstream oss;
-  oss << stats;
-  lua_pushstring(L, oss.str().c_str());
+  try {
+    z3::stats stats = solver->statistics();
+    lua_createtable(L, 0, static_cast<int>(stats.size()));
+    for (unsigned i = 0; i < stats.size(); ++i) {
+      if (stats.is_uint(i)) {
+        lua_pushinteger(L, stats.uint_value(i));
+      } else {
+        lua_pushnumber(L, stats.double_value(i));
+      }
+      lua_setfield(L, -2, stats.key(i).c_str());
+    }
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// Turn instrumentation on or off. Turning it on resets the counters.
+static int Solver_instrument(lua_State* L) {
+  auto* solver = checkSolver(L, 1);
+  bool enable = lua_isnone(L, 2) || lua_toboolean(L, 2);
+  if (enable && !solver->instrumented) {
+    solver->metrics = LuaSolver::Metrics();
+  }
+  solver->instrumented = enable;
+  return 0;
+}
+
+// Get the instrumentation counters, or nil if instrumentation is off
+static int Solver_metrics(lua_State* L) {
+  auto* solver = checkSolver(L, 1);
+  if (!solver->instrumented) {
+    lua_pushnil(L);
+    return 1;
+  }
+  const auto& metrics = solver->metrics;
+  lua_createtable(L, 0, 6);
+  lua_pushinteger(L, metrics.checks);
+  lua_setfield(L, -2, "checks");
+  lua_pushinteger(L, metrics.adds);
+  lua_setfield(L, -2, "adds");
+  lua_pushinteger(L, solver->assertions().size());
+  lua_setfield(L, -2, "assertions");
+  lua_pushnumber(L, metrics.check_seconds);
+  lua_setfield(L, -2, "check_seconds");
+  lua_pushnumber(L, metrics.last_check_seconds);
+  lua_setfield(L, -2, "last_check_seconds");
+  lua_pushnumber(L, metrics.max_check_seconds);
+  lua_setfield(L, -2, "max_check_seconds");
   return 1;
 }
 
+// Load the assertions of an SMT-LIB2 benchmark into the solver
+static int Solver_from_string(lua_State* L) {
+  auto* solver = checkSolver(L, 1);
+  const char* source = luaL_checkstring(L, 2);
+  try {
+    solver->from_string(source);
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+  return 0;
+}
+
+static int Solver_from_file(lua_State* L) {
+  auto* solver = checkSolver(L, 1);
+  const char* path = luaL_checkstring(L, 2);
+  try {
+    solver->from_file(path);
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+  return 0;
+}
+
 // Convert solver to SMT-LIB2 format
 static int Solver_to_smt2(lua_State* L) {
   auto* solver = checkSolver(L, 1);
@@ -102,20 +472,59 @@ static int Solver_to_smt2(lua_State* L) {
   return 1;
 }
 
+// Stream the assertions to a file without building the whole benchmark as
+// one string; see writeSmt2 for the options
+static int Solver_write_smt2(lua_State* L) {
+  auto* solver = checkSolver(L, 1);
+  const char* path = luaL_checkstring(L, 2);
+  z3::expr_vector assertions(solver->ctx());
+  try {
+    assertions = solver->assertions();
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+  return writeSmt2(L, path, assertions, 3, true);
+}
+
 static int Solver_tostring(lua_State* L) {
   auto* solver = checkSolver(L, 1);
   lua_pushstring(L, solver->to_smt2().c_str());
   return 1;
 }
 
+// Copy the solver, with its assertions and parameters, into another context
+// (or the same one, to clone it). The copy is independent of the original.
+// Z3_solver_translate does not carry over solver-level settings such as
+// timeout and rlimit, so everything set through solver:set is applied again.
+static int Solver_translate(lua_State* L) {
+  auto* solver = checkSolver(L, 1);
+  auto* target = luaW_check<z3::context>(L, 2);
+  try {
+    auto* copy = new LuaSolver(*target, *solver, z3::solver::translate());
+    retainContext(*target);
+    luaW_push<z3::solver>(L, copy);
+    luaW_hold<z3::solver>(L, copy);
+    copy->params = solver->params;
+    z3::params settings(*target);
+    applyParams(copy->params, settings);
+    copy->set(settings);
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
 // Allocator - requires a context
 static z3::solver* Solver_allocator(lua_State* L) {
   auto* ctx = luaW_check<z3::context>(L, 1);
-  return new z3::solver(*ctx);
+  retainContext(*ctx);
+  return new LuaSolver(*ctx);
 }
 
 static void Solver_deallocator(lua_State* L, z3::solver* solver) {
-  delete solver;
+  z3::context& ctx = solver->ctx();
+  delete static_cast<LuaSolver*>(solver);
+  releaseContext(ctx);
 }
 
 static luaL_Reg solverTable[] = {
@@ -124,15 +533,26 @@ static luaL_Reg solverTable[] = {
 
 static luaL_Reg solverMetatable[] = {
     {"add", Solver_add},
+    {"set", Solver_set},
     {"check", Solver_check},
+    {"check_async", Solver_check_async},
     {"get_model", Solver_get_model},
+    {"unsat_core", Solver_unsat_core},
+    {"all_models", Solver_all_models},
+    {"cubes", Solver_cubes},
     {"reset", Solver_reset},
     {"push", Solver_push},
     {"pop", Solver_pop},
     {"assertions", Solver_assertions},
     {"reason_unknown", Solver_reason_unknown},
     {"statistics", Solver_statistics},
+    {"instrument", Solver_instrument},
+    {"metrics", Solver_metrics},
     {"to_smt2", Solver_to_smt2},
+    {"write_smt2", Solver_write_smt2},
+    {"translate", Solver_translate},
+    {"from_string", Solver_from_string},
+    {"from_file", Solver_from_file},
     {"__tostring", Solver_tostring},
     {NULL, NULL}
 };
@@ -0,0 +1,227 @@
+#include "z3/LuaTactic.hpp"
+#include "z3/LuaContext.hpp"
+#include "z3/LuaExpr.hpp"
+#include "z3/LuaExprVector.hpp"
+#include "z3/LuaGoal.hpp"
+#include "z3/LuaParams.hpp"
+#include "z3/LuaSolver.hpp"
+#include <climits>
+#include <vector>
+
+z3::tactic* checkTactic(lua_State* L, int index) {
+  return luaW_check<z3::tactic>(L, index);
+}
+
+void pushTactic(lua_State* L, const z3::tactic& tactic) {
+  auto* copy = new z3::tactic(tactic);
+  retainContext(copy->ctx());
+  luaW_push<z3::tactic>(L, copy);
+  luaW_hold<z3::tactic>(L, copy);
+}
+
+// Collect the tactics passed to a combinator, either individually or as one
+// array table.
+static std::vector<z3::tactic> checkTacticArgs(lua_State* L, const char* name) {
+  std::vector<z3::tactic> tactics;
+  if (lua_gettop(L) == 1 && lua_istable(L, 1)) {
+    int n = static_cast<int>(lua_rawlen(L, 1));
+    for (int i = 1; i <= n; ++i) {
+      lua_rawgeti(L, 1, i);
+      tactics.push_back(*checkTactic(L, -1));
+      lua_pop(L, 1);
+    }
+  } else {
+    for (int i = 1; i <= lua_gettop(L); ++i) {
+      tactics.push_back(*checkTactic(L, i));
+    }
+  }
+  if (tactics.empty()) {
+    luaL_error(L, "%s expects at least one tactic", name);
+  }
+  return tactics;
+}
+
+// Apply the tactic to a goal, or to an expression, array or z3.expr_vector
+// which is wrapped in a fresh goal first. Returns an array of subgoals.
+static int Tactic_apply(lua_State* L) {
+  auto* tactic = checkTactic(L, 1);
+  try {
+    z3::context& ctx = tactic->ctx();
+    z3::goal goal(ctx);
+    if (auto* g = luaW_to<z3::goal>(L, 2)) {
+      goal = *g;
+    } else if (lua_istable(L, 2) || toExprVector(L, 2)) {
+      z3::expr_vector vec(ctx);
+      checkExprArray(L, 2, vec);
+      goal.add(vec);
+    } else {
+      goal.add(*checkExpr(L, 2));
+    }
+    Z3_apply_result r;
+    if (lua_isnoneornil(L, 3)) {
+      r = Z3_tactic_apply(ctx, *tactic, goal);
+    } else {
+      z3::params params = checkParams(L, 3, ctx);
+      r = Z3_tactic_apply_ex(ctx, *tactic, goal, params);
+    }
+    ctx.check_error();
+    z3::apply_result result(ctx, r);
+    lua_createtable(L, static_cast<int>(result.size()), 0);
+    for (unsigned i = 0; i < result.size(); ++i) {
+      pushGoal(L, result[i]);
+      lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// Build a solver that runs this tactic on every check. The solver supports
+// push/pop and incremental use like any other z3.solver.
+static int Tactic_solver(lua_State* L) {
+  auto* tactic = checkTactic(L, 1);
+  try {
+    z3::context& ctx = tactic->ctx();
+    Z3_solver s = Z3_mk_solver_from_tactic(ctx, *tactic);
+    ctx.check_error();
+    auto* solver = new LuaSolver(ctx, s);
+    retainContext(ctx);
+    luaW_push<z3::solver>(L, solver);
+    luaW_hold<z3::solver>(L, solver);
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+static int Tactic_help(lua_State* L) {
+  auto* tactic = checkTactic(L, 1);
+  lua_pushstring(L, tactic->help().c_str());
+  return 1;
+}
+
+// z3.Then(t1, t2, ...): run each tactic on the subgoals of the previous one
+int z3_Then(lua_State* L) {
+  auto tactics = checkTacticArgs(L, "Then");
+  try {
+    z3::tactic result = tactics[0];
+    for (size_t i = 1; i < tactics.size(); ++i) {
+      result = result & tactics[i];
+    }
+    pushTactic(L, result);
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// z3.OrElse(t1, t2, ...): the first tactic that does not fail
+int z3_OrElse(lua_State* L) {
+  auto tactics = checkTacticArgs(L, "OrElse");
+  try {
+    z3::tactic result = tactics[0];
+    for (size_t i = 1; i < tactics.size(); ++i) {
+      result = result | tactics[i];
+    }
+    pushTactic(L, result);
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// z3.ParOr(t1, t2, ...): run the tactics in parallel, first to succeed wins
+int z3_ParOr(lua_State* L) {
+  auto tactics = checkTacticArgs(L, "ParOr");
+  try {
+    pushTactic(L, z3::par_or(static_cast<unsigned>(tactics.size()),
+                             tactics.data()));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// z3.TryFor(t, ms): fail if the tactic runs longer than ms milliseconds
+int z3_TryFor(lua_State* L) {
+  auto* tactic = checkTactic(L, 1);
+  lua_Integer ms = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, ms >= 0 && ms <= UINT_MAX, 2, "timeout out of range");
+  try {
+    pushTactic(L, z3::try_for(*tactic, static_cast<unsigned>(ms)));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// z3.Repeat(t[, max]): apply t to its own subgoals until a fixpoint, at most
+// max times
+int z3_Repeat(lua_State* L) {
+  auto* tactic = checkTactic(L, 1);
+  lua_Integer max = luaL_optinteger(L, 2, UINT_MAX);
+  luaL_argcheck(L, max >= 0 && max <= UINT_MAX, 2, "count out of range");
+  try {
+    pushTactic(L, z3::repeat(*tactic, static_cast<unsigned>(max)));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// z3.With(t, params): the tactic with the given parameters fixed
+int z3_With(lua_State* L) {
+  auto* tactic = checkTactic(L, 1);
+  try {
+    z3::params params = checkParams(L, 2, tactic->ctx());
+    pushTactic(L, z3::with(*tactic, params));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// Allocator - requires a context and a tactic name
+static z3::tactic* Tactic_allocator(lua_State* L) {
+  auto* ctx = luaW_check<z3::context>(L, 1);
+  const char* name = luaL_checkstring(L, 2);
+  z3::tactic* tactic;
+  try {
+    tactic = new z3::tactic(*ctx, name);
+  } catch (const z3::exception& e) {
+    luaL_error(L, "z3 error: %s", e.msg());
+    return nullptr;
+  }
+  retainContext(*ctx);
+  return tactic;
+}
+
+static void Tactic_deallocator(lua_State* L, z3::tactic* tactic) {
+  z3::context& ctx = tactic->ctx();
+  delete tactic;
+  releaseContext(ctx);
+}
+
+static luaL_Reg tacticTable[] = {
+    {NULL, NULL}
+};
+
+static luaL_Reg tacticMetatable[] = {
+    {"apply", Tactic_apply},
+    {"solver", Tactic_solver},
+    {"help", Tactic_help},
+    {NULL, NULL}
+};
+
+int luaopen_z3_tactic(lua_State* L) {
+  LUAZ3_REGISTER_TYPE<z3::tactic>(
+      L,
+      "z3.tactic",
+      tacticTable,
+      tacticMetatable,
+      Tactic_allocator,
+      Tactic_deallocator
+  );
+  return 1;
+}
@@ -4,111 +4,419 @@
 #include "z3/LuaExpr.hpp"
 #include "z3/LuaSort.hpp"
 #include "z3/LuaModel.hpp"
+#include "z3/LuaCheckHandle.hpp"
+#include "z3/LuaParallel.hpp"
+#include "z3/LuaOptimize.hpp"
+#include "z3/LuaExprVector.hpp"
+#include "z3/LuaParams.hpp"
+#include "z3/LuaGoal.hpp"
+#include "z3/LuaTactic.hpp"
+#include "z3/LuaFuncDecl.hpp"
+#include "z3/LuaPattern.hpp"
+#include <climits>
+#include <vector>
+
+// Fetch the i-th argument of an n-ary builder, either from the stack or from
+// the array table passed as its only argument. The returned pointer stays
+// valid because the table still references the userdata.
+static z3::expr* checkExprArg(lua_State* L, bool packed, int i) {
+  if (!packed) {
+    return checkExpr(L, i);
+  }
+  lua_rawgeti(L, 1, i);
+  auto* expr = checkExpr(L, -1);
+  lua_pop(L, 1);
+  return expr;
+}
+
+// Collect the arguments of an n-ary builder into a single vector. The
+// arguments may be passed either individually or as one array table or
+// z3.expr_vector; the packed forms avoid the limit on the number of values a
+// C function can receive on the Lua stack, which large encodings easily
+// exceed.
+static z3::expr_vector checkExprArgs(lua_State* L, const char* name, int min) {
+  if (lua_gettop(L) == 1 && toExprVector(L, 1) != nullptr) {
+    z3::expr_vector* vec = toExprVector(L, 1);
+    if (static_cast<int>(vec->size()) < min) {
+      luaL_error(L, "z3.%s requires at least %d argument%s", name, min,
+                 min == 1 ? "" : "s");
+    }
+    return *vec;
+  }
+  bool packed = lua_gettop(L) == 1 && lua_istable(L, 1);
+  int n = packed ? static_cast<int>(lua_rawlen(L, 1)) : lua_gettop(L);
+  if (n < min) {
+    luaL_error(L, "z3.%s requires at least %d argument%s", name, min,
+               min == 1 ? "" : "s");
+  }
+  z3::expr_vector vec(checkExprArg(L, packed, 1)->ctx());
+  for (int i = 1; i <= n; ++i) {
+    vec.push_back(*checkExprArg(L, packed, i));
+  }
+  return vec;
+}
 
 // Helper functions for creating expressions from Lua values
 static int z3_And(lua_State* L) {
-  int n = lua_gettop(L);
-  if (n < 2) {
-    return luaL_error(L, "z3.And requires at least 2 arguments");
-  }
-  auto* first = luaW_check<z3::expr>(L, 1);
-  z3::expr result = *first;
-  for (int i = 2; i <= n; ++i) {
-    auto* expr = luaW_check<z3::expr>(L, i);
-    result = result && *expr;
-  }
-  auto* res = new z3::expr(result);
-  luaW_push<z3::expr>(L, res);
-  return 1;
+  z3::expr_vector args = checkExprArgs(L, "And", 2);
+  try {
+    pushExpr(L, z3::mk_and(args));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
 }
 
 static int z3_Or(lua_State* L) {
-  int n = lua_gettop(L);
-  if (n < 2) {
-    return luaL_error(L, "z3.Or requires at least 2 arguments");
-  }
-  auto* first = luaW_check<z3::expr>(L, 1);
-  z3::expr result = *first;
-  for (int i = 2; i <= n; ++i) {
-    auto* expr = luaW_check<z3::expr>(L, i);
-    result = result || *expr;
-  }
-  auto* res = new z3::expr(result);
-  luaW_push<z3::expr>(L, res);
-  return 1;
+  z3::expr_vector args = checkExprArgs(L, "Or", 2);
+  try {
+    pushExpr(L, z3::mk_or(args));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
 }
 
 static int z3_Not(lua_State* L) {
-  auto* expr = luaW_check<z3::expr>(L, 1);
-  auto* result = new z3::expr(!(*expr));
-  luaW_push<z3::expr>(L, result);
+  auto* expr = checkExpr(L, 1);
+  pushExpr(L, !(*expr));
   return 1;
 }
 
 static int z3_Implies(lua_State* L) {
-  auto* a = luaW_check<z3::expr>(L, 1);
-  auto* b = luaW_check<z3::expr>(L, 2);
-  auto* result = new z3::expr(z3::implies(*a, *b));
-  luaW_push<z3::expr>(L, result);
+  auto* a = checkExpr(L, 1);
+  auto* b = checkExpr(L, 2);
+  pushExpr(L, z3::implies(*a, *b));
   return 1;
 }
 
 static int z3_Ite(lua_State* L) {
-  auto* cond = luaW_check<z3::expr>(L, 1);
-  auto* then_expr = luaW_check<z3::expr>(L, 2);
-  auto* else_expr = luaW_check<z3::expr>(L, 3);
-  auto* result = new z3::expr(z3::ite(*cond, *then_expr, *else_expr));
-  luaW_push<z3::expr>(L, result);
+  auto* cond = checkExpr(L, 1);
+  auto* then_expr = checkExpr(L, 2);
+  auto* else_expr = checkExpr(L, 3);
+  pushExpr(L, z3::ite(*cond, *then_expr, *else_expr));
   return 1;
 }
 
 static int z3_Distinct(lua_State* L) {
-  int n = lua_gettop(L);
-  if (n < 2) {
-    return luaL_error(L, "z3.Distinct requires at least 2 arguments");
+  z3::expr_vector args = checkExprArgs(L, "Distinct", 2);
+  try {
+    pushExpr(L, z3::distinct(args));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
   }
-  auto* first = luaW_check<z3::expr>(L, 1);
-  z3::expr_vector vec(first->ctx());
-  for (int i = 1; i <= n; ++i) {
-    auto* expr = luaW_check<z3::expr>(L, i);
-    vec.push_back(*expr);
-  }
-  auto* result = new z3::expr(z3::distinct(vec));
-  luaW_push<z3::expr>(L, result);
-  return 1;
 }
 
 // Arithmetic helpers
+
+// Z3_mk_add and Z3_mk_mul only take arithmetic terms, and the bit-vector
+// versions are binary, so n-ary bit-vector input is folded left to right.
+static z3::expr foldBv(const z3::expr_vector& args,
+                       Z3_ast (*op)(Z3_context, Z3_ast, Z3_ast)) {
+  z3::context& ctx = args.ctx();
+  z3::expr result = args[0];
+  for (unsigned i = 1; i < args.size(); ++i) {
+    Z3_ast r = op(ctx, result, args[i]);
+    ctx.check_error();
+    result = z3::expr(ctx, r);
+  }
+  return result;
+}
+
 static int z3_Sum(lua_State* L) {
-  int n = lua_gettop(L);
-  if (n < 1) {
-    return luaL_error(L, "z3.Sum requires at least 1 argument");
-  }
-  auto* first = luaW_check<z3::expr>(L, 1);
-  z3::expr result = *first;
-  for (int i = 2; i <= n; ++i) {
-    auto* expr = luaW_check<z3::expr>(L, i);
-    result = result + *expr;
-  }
-  auto* res = new z3::expr(result);
-  luaW_push<z3::expr>(L, res);
-  return 1;
+  z3::expr_vector args = checkExprArgs(L, "Sum", 1);
+  try {
+    if (args[0].is_bv()) {
+      pushExpr(L, foldBv(args, Z3_mk_bvadd));
+    } else {
+      pushExpr(L, z3::sum(args));
+    }
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
 }
 
 static int z3_Product(lua_State* L) {
-  int n = lua_gettop(L);
-  if (n < 1) {
-    return luaL_error(L, "z3.Product requires at least 1 argument");
-  }
-  auto* first = luaW_check<z3::expr>(L, 1);
-  z3::expr result = *first;
-  for (int i = 2; i <= n; ++i) {
-    auto* expr = luaW_check<z3::expr>(L, i);
-    result = result * *expr;
-  }
-  auto* res = new z3::expr(result);
-  luaW_push<z3::expr>(L, res);
-  return 1;
+  z3::expr_vector args = checkExprArgs(L, "Product", 1);
+  try {
+    if (args[0].is_bv()) {
+      pushExpr(L, foldBv(args, Z3_mk_bvmul));
+      return 1;
+    }
+    z3::context& ctx = args.ctx();
+    z3::array<Z3_ast> asts(args);
+    Z3_ast r = Z3_mk_mul(ctx, asts.size(), asts.ptr());
+    ctx.check_error();
+    pushExpr(L, z3::expr(ctx, r));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// Pseudo-Boolean and cardinality constraints. The literals are an array or a
+// z3.expr_vector of Boolean expressions; coefficients and bounds must fit in
+// a C int, as required by the Z3 API.
+static z3::expr_vector checkLiterals(lua_State* L, int index) {
+  if (auto* vec = toExprVector(L, index)) {
+    luaL_argcheck(L, !vec->empty(), index, "expected at least one literal");
+    return *vec;
+  }
+  luaL_checktype(L, index, LUA_TTABLE);
+  luaL_argcheck(L, lua_rawlen(L, index) > 0, index,
+                "expected at least one literal");
+  lua_rawgeti(L, index, 1);
+  z3::expr_vector literals(checkExpr(L, -1)->ctx());
+  lua_pop(L, 1);
+  checkExprArray(L, index, literals);
+  return literals;
+}
+
+static int checkBound(lua_State* L, int index) {
+  lua_Integer bound = luaL_checkinteger(L, index);
+  luaL_argcheck(L, bound >= INT_MIN && bound <= INT_MAX, index,
+                "bound out of range");
+  return static_cast<int>(bound);
+}
+
+static std::vector<int> checkCoefficients(lua_State* L, int index,
+                                          unsigned count) {
+  luaL_checktype(L, index, LUA_TTABLE);
+  luaL_argcheck(L, lua_rawlen(L, index) == count, index,
+                "expected one coefficient per literal");
+  std::vector<int> coeffs(count);
+  for (unsigned i = 0; i < count; ++i) {
+    lua_rawgeti(L, index, static_cast<int>(i + 1));
+    coeffs[i] = checkBound(L, lua_gettop(L));
+    lua_pop(L, 1);
+  }
+  return coeffs;
+}
+
+// z3.AtMost(literals, k): at most k of the literals are true
+static int z3_AtMost(lua_State* L) {
+  z3::expr_vector literals = checkLiterals(L, 1);
+  int k = checkBound(L, 2);
+  luaL_argcheck(L, k >= 0, 2, "bound must be non-negative");
+  try {
+    pushExpr(L, z3::atmost(literals, static_cast<unsigned>(k)));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// z3.AtLeast(literals, k): at least k of the literals are true
+static int z3_AtLeast(lua_State* L) {
+  z3::expr_vector literals = checkLiterals(L, 1);
+  int k = checkBound(L, 2);
+  luaL_argcheck(L, k >= 0, 2, "bound must be non-negative");
+  try {
+    pushExpr(L, z3::atleast(literals, static_cast<unsigned>(k)));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// z3.PbLe(literals, coeffs, k): sum of coeffs[i] over true literals[i] <= k
+static int z3_PbLe(lua_State* L) {
+  z3::expr_vector literals = checkLiterals(L, 1);
+  std::vector<int> coeffs = checkCoefficients(L, 2, literals.size());
+  int k = checkBound(L, 3);
+  try {
+    pushExpr(L, z3::pble(literals, coeffs.data(), k));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// z3.PbGe(literals, coeffs, k): the weighted sum is >= k
+static int z3_PbGe(lua_State* L) {
+  z3::expr_vector literals = checkLiterals(L, 1);
+  std::vector<int> coeffs = checkCoefficients(L, 2, literals.size());
+  int k = checkBound(L, 3);
+  try {
+    pushExpr(L, z3::pbge(literals, coeffs.data(), k));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// z3.PbEq(literals, coeffs, k): the weighted sum is exactly k
+static int z3_PbEq(lua_State* L) {
+  z3::expr_vector literals = checkLiterals(L, 1);
+  std::vector<int> coeffs = checkCoefficients(L, 2, literals.size());
+  int k = checkBound(L, 3);
+  try {
+    pushExpr(L, z3::pbeq(literals, coeffs.data(), k));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+// Read one entry of a quantifier's patterns option: a z3.pattern, a single
+// term, or an array of terms forming a multi-pattern.
+static z3::ast checkPatternEntry(lua_State* L, int index, z3::context& ctx) {
+  if (auto* pattern = toPattern(L, index)) {
+    return *pattern;
+  }
+  z3::expr_vector terms(ctx);
+  if (lua_istable(L, index) || toExprVector(L, index)) {
+    checkExprArray(L, index, terms);
+  } else {
+    terms.push_back(*checkExpr(L, index));
+  }
+  z3::array<Z3_ast> args(terms);
+  Z3_pattern p = Z3_mk_pattern(ctx, args.size(), args.ptr());
+  ctx.check_error();
+  return z3::ast(ctx, reinterpret_cast<Z3_ast>(p));
+}
+
+// z3.ForAll(vars, body[, options]) and z3.Exists(...). vars is a constant, an
+// array or a z3.expr_vector of constants to bind. Options: patterns (array of
+// z3.pattern, terms or arrays of terms), no_patterns (array of terms),
+// weight, qid and skid.
+static int pushQuantifier(lua_State* L, bool is_forall) {
+  auto* body = checkExpr(L, 2);
+  z3::context& ctx = body->ctx();
+  z3::expr_vector vars(ctx);
+  if (lua_istable(L, 1) || toExprVector(L, 1)) {
+    checkExprArray(L, 1, vars);
+  } else {
+    vars.push_back(*checkExpr(L, 1));
+  }
+  for (unsigned i = 0; i < vars.size(); ++i) {
+    if (!vars[i].is_const()) {
+      return luaL_error(L, "bound variable %d is not a constant",
+                        static_cast<int>(i + 1));
+    }
+  }
+  luaL_argcheck(L, !vars.empty(), 1, "expected at least one bound variable");
+
+  unsigned weight = 0;
+  const char* qid = nullptr;
+  const char* skid = nullptr;
+  std::vector<z3::ast> patterns;
+  z3::expr_vector no_patterns(ctx);
+  try {
+    if (!lua_isnoneornil(L, 3)) {
+      luaL_checktype(L, 3, LUA_TTABLE);
+      lua_getfield(L, 3, "patterns");
+      if (!lua_isnil(L, -1)) {
+        luaL_checktype(L, -1, LUA_TTABLE);
+        int n = static_cast<int>(lua_rawlen(L, -1));
+        for (int i = 1; i <= n; ++i) {
+          lua_rawgeti(L, -1, i);
+          patterns.push_back(checkPatternEntry(L, lua_gettop(L), ctx));
+          lua_pop(L, 1);
+        }
+      }
+      lua_getfield(L, 3, "no_patterns");
+      if (!lua_isnil(L, -1)) {
+        checkExprArray(L, lua_gettop(L), no_patterns);
+      }
+      lua_getfield(L, 3, "weight");
+      weight = static_cast<unsigned>(luaL_optinteger(L, -1, 0));
+      lua_getfield(L, 3, "qid");
+      qid = luaL_optstring(L, -1, nullptr);
+      lua_getfield(L, 3, "skid");
+      skid = luaL_optstring(L, -1, nullptr);
+    }
+
+    std::vector<Z3_app> bound;
+    for (unsigned i = 0; i < vars.size(); ++i) {
+      bound.push_back(reinterpret_cast<Z3_app>(static_cast<Z3_ast>(vars[i])));
+    }
+    std::vector<Z3_pattern> pattern_asts;
+    for (const auto& pattern : patterns) {
+      pattern_asts.push_back(
+          reinterpret_cast<Z3_pattern>(static_cast<Z3_ast>(pattern)));
+    }
+    z3::array<Z3_ast> no_pattern_asts(no_patterns);
+    Z3_ast q = Z3_mk_quantifier_const_ex(
+        ctx, is_forall, weight,
+        qid ? Z3_mk_string_symbol(ctx, qid) : nullptr,
+        skid ? Z3_mk_string_symbol(ctx, skid) : nullptr,
+        static_cast<unsigned>(bound.size()), bound.data(),
+        static_cast<unsigned>(pattern_asts.size()), pattern_asts.data(),
+        no_pattern_asts.size(), no_pattern_asts.ptr(),
+        *body);
+    ctx.check_error();
+    pushExpr(L, z3::expr(ctx, q));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
+static int z3_ForAll(lua_State* L) {
+  return pushQuantifier(L, true);
+}
+
+static int z3_Exists(lua_State* L) {
+  return pushQuantifier(L, false);
+}
+
+// Simplify many expressions at once: z3.simplify_all(exprs[, params]).
+// The expressions become the arguments of one application of a fresh
+// uninterpreted function, so a single simplifier run with one cache covers
+// them all and shared subterms are only simplified once. Returns the results
+// in the same kind of container that was passed in.
+static int z3_simplify_all(lua_State* L) {
+  z3::expr_vector* vec = toExprVector(L, 1);
+  z3::context* ctx_ptr;
+  if (vec != nullptr) {
+    ctx_ptr = &vec->ctx();
+  } else {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    if (lua_rawlen(L, 1) == 0) {
+      lua_newtable(L);
+      return 1;
+    }
+    ctx_ptr = &checkExprArg(L, true, 1)->ctx();
+  }
+  z3::context& ctx = *ctx_ptr;
+  z3::expr_vector exprs(ctx);
+  checkExprArray(L, 1, exprs);
+  z3::params params(ctx);
+  if (!lua_isnoneornil(L, 2)) {
+    setParams(L, 2, params);
+  }
+  try {
+    z3::expr_vector results(ctx);
+    unsigned n = exprs.size();
+    if (n > 0) {
+      std::vector<Z3_sort> domain(n);
+      for (unsigned i = 0; i < n; ++i) {
+        domain[i] = exprs[i].get_sort();
+      }
+      z3::func_decl wrap(ctx, Z3_mk_fresh_func_decl(ctx, "simplify_all", n,
+                                                    domain.data(), ctx.bool_sort()));
+      z3::expr simplified(ctx, Z3_simplify_ex(ctx, wrap(exprs), params));
+      ctx.check_error();
+      for (unsigned i = 0; i < n; ++i) {
+        results.push_back(simplified.arg(i));
+      }
+    }
+    if (vec != nullptr) {
+      pushExprVector(L, results);
+      return 1;
+    }
+    lua_createtable(L, static_cast<int>(n), 0);
+    for (unsigned i = 0; i < n; ++i) {
+      pushExpr(L, results[i]);
+      lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
 }
 
 // Module-level functions
@@ -121,12 +429,28 @@ static luaL_Reg z3Functions[] = {
     {"Distinct", z3_Distinct},
     {"Sum", z3_Sum},
     {"Product", z3_Product},
+    {"AtMost", z3_AtMost},
+    {"AtLeast", z3_AtLeast},
+    {"PbLe", z3_PbLe},
+    {"PbGe", z3_PbGe},
+    {"PbEq", z3_PbEq},
+    {"ForAll", z3_ForAll},
+    {"Exists", z3_Exists},
+    {"simplify_all", z3_simplify_all},
+    {"portfolio", z3_portfolio},
+    {"cube_and_conquer", z3_cube_and_conquer},
+    {"Then", z3_Then},
+    {"OrElse", z3_OrElse},
+    {"ParOr", z3_ParOr},
+    {"TryFor", z3_TryFor},
+    {"Repeat", z3_Repeat},
+    {"With", z3_With},
     {NULL, NULL}
 };
 
 // Context constructor wrapper
 static int z3_Context(lua_State* L) {
-  auto* ctx = new z3::context();
+  auto* ctx = new LuaContext();
   luaW_push<z3::context>(L, ctx);
   luaW_hold<z3::context>(L, ctx);
   return 1;
@@ -135,12 +459,44 @@ static int z3_Context(lua_State* L) {
 // Solver constructor wrapper
 static int z3_Solver(lua_State* L) {
   auto* ctx = luaW_check<z3::context>(L, 1);
-  auto* solver = new z3::solver(*ctx);
+  auto* solver = new LuaSolver(*ctx);
+  retainContext(*ctx);
   luaW_push<z3::solver>(L, solver);
   luaW_hold<z3::solver>(L, solver);
   return 1;
 }
 
+// Optimize constructor wrapper
+static int z3_Optimize(lua_State* L) {
+  auto* ctx = luaW_check<z3::context>(L, 1);
+  auto* opt = new z3::optimize(*ctx);
+  retainContext(*ctx);
+  luaW_push<z3::optimize>(L, opt);
+  luaW_hold<z3::optimize>(L, opt);
+  return 1;
+}
+
+static int z3_Goal(lua_State* L) {
+  auto* ctx = luaW_check<z3::context>(L, 1);
+  auto* goal = new z3::goal(*ctx);
+  retainContext(*ctx);
+  luaW_push<z3::goal>(L, goal);
+  luaW_hold<z3::goal>(L, goal);
+  return 1;
+}
+
+// z3.Tactic(ctx, name), e.g. "simplify", "solve-eqs" or "bit-blast"
+static int z3_Tactic(lua_State* L) {
+  auto* ctx = luaW_check<z3::context>(L, 1);
+  const char* name = luaL_checkstring(L, 2);
+  try {
+    pushTactic(L, z3::tactic(*ctx, name));
+    return 1;
+  } catch (const z3::exception& e) {
+    return luaL_error(L, "z3 error: %s", e.msg());
+  }
+}
+
 extern "C" {
 
 #ifdef _WIN32
@@ -155,7 +511,14 @@ int luaopen_z3_native(lua_State* L) {
   luaopen_z3_expr(L);
   luaopen_z3_sort(L);
   luaopen_z3_model(L);
-  lua_pop(L, 5);
+  luaopen_z3_check_handle(L);
+  luaopen_z3_optimize(L);
+  luaopen_z3_expr_vector(L);
+  luaopen_z3_goal(L);
+  luaopen_z3_tactic(L);
+  luaopen_z3_func_decl(L);
+  luaopen_z3_pattern(L);
+  lua_pop(L, 12);
 
   // Create the z3 module table
   lua_newtable(L);
@@ -168,6 +531,16 @@ int luaopen_z3_native(lua_State* L) {
   lua_pushcfunction(L, z3_Solver);
   lua_setfield(L, -2, "Solver");
 
+  // Add the Optimize constructor
+  lua_pushcfunction(L, z3_Optimize);
+  lua_setfield(L, -2, "Optimize");
+
+  // Add the Goal and Tactic constructors
+  lua_pushcfunction(L, z3_Goal);
+  lua_setfield(L, -2, "Goal");
+  lua_pushcfunction(L, z3_Tactic);
+  lua_setfield(L, -2, "Tactic");
+
   // Add module-level functions
   luaL_setfuncs(L, z3Functions, 0);
 
@@ -0,0 +1,51 @@
+-- Microbenchmark: cost of building one expression with an operator metamethod.
+-- Usage: lua bench/expr_alloc.lua [iterations]
+--
+-- Reports the Lua heap growth and the wall time per `a + b`. The collector is
+-- stopped while measuring so that every byte the binding allocates on the Lua
+-- side is counted. Run it against two builds of z3_native to compare them.
+-- C++ heap allocations are not visible from Lua; on ELF platforms the C++
+-- harness counts them (lua_z3_bench --benchmark_filter=expr/add).
+
+local z3 = require 'z3'
+
+local iterations = tonumber(arg and arg[1]) or 100000
+
+local ctx = z3.Context()
+local a = ctx:int_const("a")
+local b = ctx:int_const("b")
+
+-- Warm up so that metatables, interned strings and Z3's own hash-consed
+-- `(+ a b)` node already exist before measuring.
+local keep = {}
+for i = 1, 1000 do
+  keep[i] = a + b
+end
+keep = nil
+
+collectgarbage("collect")
+collectgarbage("stop")
+
+local results = {}
+local before_kb = collectgarbage("count")
+local start = os.clock()
+for i = 1, iterations do
+  results[i] = a + b
+end
+local elapsed = os.clock() - start
+local after_kb = collectgarbage("count")
+
+-- Account for the results table itself (one array slot per iteration).
+local slots = {}
+local slots_before_kb = collectgarbage("count")
+for i = 1, iterations do
+  slots[i] = true
+end
+local slots_kb = collectgarbage("count") - slots_before_kb
+
+collectgarbage("restart")
+
+local bytes = ((after_kb - before_kb) - slots_kb) * 1024 / iterations
+print(string.format("iterations:         %d", iterations))
+print(string.format("lua bytes per a+b:  %.1f", bytes))
+print(string.format("ns per a+b:         %.1f", elapsed * 1e9 / iterations))
@@ -0,0 +1,270 @@
+// Benchmark harness for lua-z3.
+//
+// Embeds Lua, links against the lua_z3 target (the z3_native shared library)
+// and runs the cases defined in bench/suite.lua. Each case is calibrated the way Google Benchmark does
+// it: the iteration count grows until one batch runs for at least the
+// minimum time. Results are written as Google Benchmark compatible JSON.
+//
+// The module must share the harness's copy of Lua. That holds on ELF
+// platforms, where the shared library binds to the Lua the executable
+// exports. With a static Lua, as on the x64-windows-static-md triplet, the
+// DLL carries a copy of its own, so use bench/run.lua there instead.
+//
+// Besides time, each case reports the heap allocations made per iteration:
+// C++ allocations (operator new, as used by the binding and the z3++ API)
+// and blocks allocated by Lua (userdata, tables, strings). Z3's internal
+// allocations do not go through operator new and are not counted. C++
+// allocations are only counted on ELF platforms: there the operator new
+// defined here replaces the one the module calls. A Windows DLL keeps using
+// the allocator it was linked with, so the column is left out.
+//
+// Usage: lua_z3_bench [--benchmark_filter=substr] [--benchmark_min_time=s]
+//                     [--benchmark_out=file] [suite.lua]
+
+#include "z3/Lua.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <string>
+#include <vector>
+
+extern "C" int luaopen_z3_native(lua_State* L);
+
+// Every C++ allocation in the process, including the solver threads
+static std::atomic<long long> cxx_allocations{0};
+
+#if defined(__ELF__)
+static constexpr bool kCountsNew = true;
+
+void* operator new(std::size_t size) {
+  cxx_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+  std::free(p);
+}
+#else
+static constexpr bool kCountsNew = false;
+#endif
+
+namespace {
+
+// Wraps the state's allocator to count the blocks Lua allocates
+struct LuaAllocator {
+  lua_Alloc alloc;
+  void* ud;
+  long long allocations;
+};
+
+void* countingAlloc(void* ud, void* ptr, size_t osize, size_t nsize) {
+  auto* allocator = static_cast<LuaAllocator*>(ud);
+  if (ptr == nullptr && nsize > 0) {
+    ++allocator->allocations;
+  }
+  return allocator->alloc(allocator->ud, ptr, osize, nsize);
+}
+
+struct Result {
+  std::string name;
+  long long iterations;
+  double real_ns;
+  double cpu_ns;
+  double cxx_allocs;
+  double lua_allocs;
+};
+
+struct Timing {
+  double real_seconds;
+  double cpu_seconds;
+  long long cxx_allocs;
+  long long lua_allocs;
+};
+
+// Call run(state) `iterations` times. The case table is at index -1.
+Timing measure(lua_State* L, LuaAllocator& allocator, int state_ref,
+               long long iterations) {
+  lua_getfield(L, -1, "run");
+  int run = lua_gettop(L);
+  lua_gc(L, LUA_GCCOLLECT, 0);
+  long long cxx_start = cxx_allocations.load();
+  long long lua_start = allocator.allocations;
+  auto real_start = std::chrono::steady_clock::now();
+  std::clock_t cpu_start = std::clock();
+  for (long long i = 0; i < iterations; ++i) {
+    lua_pushvalue(L, run);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, state_ref);
+    if (lua_pcall(L, 1, 0, 0) != 0) {
+      std::fprintf(stderr, "%s\n", lua_tostring(L, -1));
+      std::exit(1);
+    }
+  }
+  std::clock_t cpu_end = std::clock();
+  std::chrono::duration<double> real = std::chrono::steady_clock::now() -
+                                       real_start;
+  long long cxx = cxx_allocations.load() - cxx_start;
+  long long lua = allocator.allocations - lua_start;
+  lua_pop(L, 1);
+  return {real.count(), double(cpu_end - cpu_start) / CLOCKS_PER_SEC, cxx,
+          lua};
+}
+
+void writeJson(std::FILE* out, const std::vector<Result>& results) {
+  char date[32];
+  std::time_t now = std::time(nullptr);
+  std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+  std::fprintf(out, "{\n  \"context\": {\n");
+  std::fprintf(out, "    \"date\": \"%s\",\n", date);
+  std::fprintf(out, "    \"executable\": \"lua_z3_bench\",\n");
+  std::fprintf(out, "    \"lua_version\": \"%s\",\n", LUA_RELEASE);
+  std::fprintf(out, "    \"z3_version\": \"%s\"\n", Z3_get_full_version());
+  std::fprintf(out, "  },\n  \"benchmarks\": [\n");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    char cxx[48] = "";
+    if (kCountsNew) {
+      std::snprintf(cxx, sizeof(cxx), "\"cxx_allocs_per_iter\": %.2f, ",
+                    r.cxx_allocs);
+    }
+    std::fprintf(out,
+                 "    {\"name\": \"%s\", \"run_type\": \"iteration\", "
+                 "\"iterations\": %lld, \"real_time\": %.1f, "
+                 "\"cpu_time\": %.1f, \"time_unit\": \"ns\", "
+                 "%s\"lua_allocs_per_iter\": %.2f}%s\n",
+                 r.name.c_str(), r.iterations, r.real_ns, r.cpu_ns, cxx,
+                 r.lua_allocs, i + 1 < results.size() ? "," : "");
+  }
+  std::fprintf(out, "  ]\n}\n");
+}
+
+bool startsWith(const char* arg, const char* prefix, const char** value) {
+  size_t n = std::strlen(prefix);
+  if (std::strncmp(arg, prefix, n) != 0) {
+    return false;
+  }
+  *value = arg + n;
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string filter;
+  double min_time = 0.5;
+  const char* out_path = nullptr;
+  const char* suite = "bench/suite.lua";
+  for (int i = 1; i < argc; ++i) {
+    const char* value;
+    if (startsWith(argv[i], "--benchmark_filter=", &value)) {
+      filter = value;
+    } else if (startsWith(argv[i], "--benchmark_min_time=", &value)) {
+      min_time = std::atof(value);
+    } else if (startsWith(argv[i], "--benchmark_out=", &value)) {
+      out_path = value;
+    } else {
+      suite = argv[i];
+    }
+  }
+
+  lua_State* L = luaL_newstate();
+  LuaAllocator allocator{nullptr, nullptr, 0};
+  allocator.alloc = lua_getallocf(L, &allocator.ud);
+  lua_setallocf(L, countingAlloc, &allocator);
+  luaL_openlibs(L);
+
+  // Make require("z3") resolve to the linked module rather than searching
+  // package.cpath for another build of it.
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "preload");
+  lua_pushcfunction(L, luaopen_z3_native);
+  lua_setfield(L, -2, "z3");
+  lua_pop(L, 2);
+
+  if (luaL_dofile(L, suite) != 0) {
+    std::fprintf(stderr, "%s\n", lua_tostring(L, -1));
+    return 1;
+  }
+  int cases = lua_gettop(L);
+
+  std::vector<Result> results;
+  int n = static_cast<int>(lua_rawlen(L, cases));
+  for (int i = 1; i <= n; ++i) {
+    lua_rawgeti(L, cases, i);
+    lua_getfield(L, -1, "name");
+    std::string name = lua_tostring(L, -1);
+    lua_pop(L, 1);
+    if (name.find(filter) == std::string::npos) {
+      lua_pop(L, 1);
+      continue;
+    }
+
+    lua_getfield(L, -1, "setup");
+    if (lua_isnil(L, -1)) {
+      // nil stays on the stack as the state
+    } else if (lua_pcall(L, 0, 1, 0) != 0) {
+      std::fprintf(stderr, "%s: %s\n", name.c_str(), lua_tostring(L, -1));
+      return 1;
+    }
+    int state_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    long long iterations = 1;
+    Timing t = measure(L, allocator, state_ref, iterations);
+    while (t.real_seconds < min_time && iterations < 1000000000LL) {
+      double scale = t.real_seconds > 0 ? min_time * 1.4 / t.real_seconds : 10;
+      iterations = static_cast<long long>(
+          iterations * std::max(2.0, std::min(scale, 10.0)));
+      t = measure(L, allocator, state_ref, iterations);
+    }
+    results.push_back({name, iterations, t.real_seconds * 1e9 / iterations,
+                       t.cpu_seconds * 1e9 / iterations,
+                       double(t.cxx_allocs) / iterations,
+                       double(t.lua_allocs) / iterations});
+    char cxx[32] = "n/a";
+    if (kCountsNew) {
+      std::snprintf(cxx, sizeof(cxx), "%.2f", results.back().cxx_allocs);
+    }
+    std::fprintf(stderr, "%-28s %12.0f ns %10lld %10s new %10.2f lua\n",
+                 name.c_str(), results.back().real_ns, iterations, cxx,
+                 results.back().lua_allocs);
+
+    luaL_unref(L, LUA_REGISTRYINDEX, state_ref);
+    lua_pop(L, 1);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+  }
+  lua_close(L);
+
+  std::FILE* out = out_path ? std::fopen(out_path, "w") : stdout;
+  if (!out) {
+    std::fprintf(stderr, "cannot open %s\n", out_path);
+    return 1;
+  }
+  writeJson(out, results);
+  if (out != stdout) {
+    std::fclose(out);
+  }
+  return 0;
+}
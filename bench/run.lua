@@ -0,0 +1,62 @@
+-- Pure-Lua runner for the benchmark suite in bench/suite.lua.
+-- Usage: lua bench/run.lua [filter] [min_time_seconds]
+--
+-- Prints Google Benchmark compatible JSON to stdout, so results from two
+-- releases can be diffed or fed to the usual comparison tools. Timing uses
+-- os.clock (CPU time); the C++ harness also reports wall time.
+
+package.path = "bench/?.lua;" .. package.path
+
+local cases = require 'suite'
+
+local filter = arg and arg[1] or ""
+local min_time = tonumber(arg and arg[2]) or 0.5
+
+-- Run `iterations` iterations and return the elapsed CPU time in seconds
+local function measure(c, state, iterations)
+  collectgarbage("collect")
+  local start = os.clock()
+  for _ = 1, iterations do
+    c.run(state)
+  end
+  return os.clock() - start
+end
+
+local results = {}
+for _, c in ipairs(cases) do
+  if c.name:find(filter, 1, true) then
+    local state = c.setup and c.setup() or nil
+    -- Grow the iteration count until one batch takes at least min_time.
+    local iterations, elapsed = 1, measure(c, state, 1)
+    while elapsed < min_time and iterations < 1e9 do
+      local scale = elapsed > 0 and min_time * 1.4 / elapsed or 10
+      iterations = math.floor(iterations * math.max(2, math.min(scale, 10)))
+      elapsed = measure(c, state, iterations)
+    end
+    results[#results + 1] = {
+      name = c.name,
+      iterations = iterations,
+      ns = elapsed * 1e9 / iterations,
+    }
+    state = nil
+    collectgarbage("collect")
+  end
+end
+
+local out = {}
+out[#out + 1] = "{"
+out[#out + 1] = '  "context": {'
+out[#out + 1] = string.format('    "date": "%s",', os.date("!%Y-%m-%dT%H:%M:%SZ"))
+out[#out + 1] = string.format('    "executable": "%s",', _VERSION)
+out[#out + 1] = '    "library_build_type": "lua"'
+out[#out + 1] = "  },"
+out[#out + 1] = '  "benchmarks": ['
+for i, r in ipairs(results) do
+  out[#out + 1] = string.format(
+      '    {"name": "%s", "run_type": "iteration", "iterations": %d, ' ..
+      '"real_time": %.1f, "cpu_time": %.1f, "time_unit": "ns"}%s',
+      r.name, r.iterations, r.ns, r.ns, i < #results and "," or "")
+end
+out[#out + 1] = "  ]"
+out[#out + 1] = "}"
+print(table.concat(out, "\n"))
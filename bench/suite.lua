@@ -0,0 +1,180 @@
+-- Benchmark cases shared by bench/run.lua and the C++ harness (bench/harness.cpp).
+--
+-- Each case has a name and a `run(state)` function that performs one
+-- iteration. The optional `setup()` builds state outside the timed region;
+-- its return value is passed to every `run` call.
+
+local z3 = require 'z3'
+
+local N = 1000
+
+local cases = {}
+
+local function case(name, setup, run)
+  cases[#cases + 1] = {name = name, setup = setup, run = run}
+end
+
+-- Constant creation -------------------------------------------------------
+
+case("context/int_const", function()
+  local names = {}
+  for i = 1, N do
+    names[i] = "x" .. i
+  end
+  return {ctx = z3.Context(), names = names}
+end, function(s)
+  local ctx, names = s.ctx, s.names
+  for i = 1, N do
+    ctx:int_const(names[i])
+  end
+end)
+
+case("context/int_consts", function()
+  return {ctx = z3.Context()}
+end, function(s)
+  s.ctx:int_consts("x", N)
+end)
+
+-- Large n-ary terms ---------------------------------------------------------
+
+case("build/sum", function()
+  local ctx = z3.Context()
+  return {xs = ctx:int_consts("x", N)}
+end, function(s)
+  z3.Sum(s.xs)
+end)
+
+case("build/and", function()
+  local ctx = z3.Context()
+  return {bs = ctx:bool_consts("b", N)}
+end, function(s)
+  z3.And(s.bs)
+end)
+
+-- Operator metamethod chains -------------------------------------------------
+
+-- A single `a + b`, so the C++ harness reports allocations per operator
+case("expr/add", function()
+  local ctx = z3.Context()
+  return {ctx = ctx, a = ctx:int_const("a"), b = ctx:int_const("b")}
+end, function(s)
+  local _ = s.a + s.b
+end)
+
+case("expr/add_chain", function()
+  local ctx = z3.Context()
+  return {x = ctx:int_const("x"), y = ctx:int_const("y")}
+end, function(s)
+  local e, y = s.x, s.y
+  for _ = 1, N do
+    e = e + y
+  end
+end)
+
+case("expr/mixed_ops", function()
+  local ctx = z3.Context()
+  return {
+    x = ctx:int_const("x"),
+    y = ctx:int_const("y"),
+    z = ctx:int_const("z"),
+  }
+end, function(s)
+  local x, y, z = s.x, s.y, s.z
+  for _ = 1, N / 10 do
+    local e = (x + y) * z - x
+    e = e:le(y * y):land((-x):lt(z))
+  end
+end)
+
+-- Solving ------------------------------------------------------------------
+
+-- Pigeonhole: 7 pigeons in 6 holes (unsat, pure SAT)
+case("solve/sat_pigeonhole", function()
+  local ctx = z3.Context()
+  local pigeons, holes = 7, 6
+  local p = {}
+  for i = 1, pigeons do
+    p[i] = ctx:bool_consts("p" .. i .. "_", holes)
+  end
+  local constraints = ctx:expr_vector()
+  for i = 1, pigeons do
+    constraints:push(z3.Or(p[i]))
+  end
+  for h = 1, holes do
+    for i = 1, pigeons do
+      for j = i + 1, pigeons do
+        constraints:push(z3.Not(z3.And(p[i][h], p[j][h])))
+      end
+    end
+  end
+  return {ctx = ctx, constraints = constraints}
+end, function(s)
+  local solver = z3.Solver(s.ctx)
+  solver:add(s.constraints)
+  assert(solver:check() == "unsat")
+end)
+
+-- Factor 60491 = 241 * 251 over 32-bit vectors (sat, bit-blasting)
+case("solve/bv_factor", function()
+  local ctx = z3.Context()
+  local x = ctx:bv_const("x", 32)
+  local y = ctx:bv_const("y", 32)
+  local one = ctx:bv_val(1, 32)
+  local bound = ctx:bv_val(256, 32)
+  local constraints = ctx:expr_vector({
+    (x * y):eq(ctx:bv_val(60491, 32)),
+    x:gt(one), x:lt(bound),
+    y:gt(one), y:lt(bound),
+  })
+  return {ctx = ctx, constraints = constraints}
+end, function(s)
+  local solver = z3.Solver(s.ctx)
+  solver:add(s.constraints)
+  assert(solver:check() == "sat")
+end)
+
+-- A chain of linear inequalities over 50 integers (sat, LIA)
+case("solve/lia_chain", function()
+  local ctx = z3.Context()
+  local xs = ctx:int_consts("x", 50)
+  local zero = ctx:int_val(0)
+  local constraints = ctx:expr_vector()
+  for i = 1, #xs do
+    constraints:push(xs[i]:ge(zero))
+  end
+  for i = 1, #xs - 1 do
+    constraints:push((xs[i] * 3 + xs[i + 1] * 5):le(ctx:int_val(100 + i)))
+  end
+  constraints:push(z3.Sum(xs):ge(ctx:int_val(600)))
+  return {ctx = ctx, constraints = constraints}
+end, function(s)
+  local solver = z3.Solver(s.ctx)
+  solver:add(s.constraints)
+  assert(solver:check() == "sat")
+end)
+
+-- Model readback -------------------------------------------------------------
+
+local function solved_model()
+  local ctx = z3.Context()
+  local xs = ctx:int_consts("x", N)
+  local solver = z3.Solver(ctx)
+  for i = 1, N do
+    solver:add(xs[i]:eq(ctx:int_val(i)))
+  end
+  assert(solver:check() == "sat")
+  return {model = solver:get_model(), xs = xs}
+end
+
+case("model/get_value", solved_model, function(s)
+  local model, xs = s.model, s.xs
+  for i = 1, #xs do
+    model:get_value(xs[i])
+  end
+end)
+
+case("model/get_values", solved_model, function(s)
+  s.model:get_values(s.xs)
+end)
+
+return cases
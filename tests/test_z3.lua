@@ -6,6 +6,23 @@ local z3 = require 'z3'
 
 _ENV = unit.create_test_env(_ENV)
 
+-- Add seven pigeons in six holes to solver: unsat, and it needs more than
+-- 10000 resource units to prove it.
+local function pigeonhole(ctx, solver)
+  local pigeons = {}
+  for i = 1, 7 do
+    pigeons[i] = ctx:bool_consts("p" .. i .. "_", 6)
+    solver:add(z3.Or(pigeons[i]))
+  end
+  for hole = 1, 6 do
+    local column = {}
+    for i = 1, 7 do
+      column[i] = pigeons[i][hole]
+    end
+    solver:add(z3.AtMost(column, 1))
+  end
+end
+
 describe('z3.Context', function()
   it('should create a context', function()
     local ctx = z3.Context()
@@ -40,6 +57,35 @@ describe('z3.Context', function()
     expect(tostring(bv)).to.be_equal_to("bv")
   end)
 
+  it('should create constants in bulk', function()
+    local ctx = z3.Context()
+    local xs = ctx:int_consts("x", 3)
+    expect(#xs).to.be_equal_to(3)
+    expect(tostring(xs[1])).to.be_equal_to("x1")
+    expect(tostring(xs[3])).to.be_equal_to("x3")
+    expect(xs[2]:is_int()).to.be_truthy()
+
+    local flags = ctx:bool_consts({"p", "q"})
+    expect(#flags).to.be_equal_to(2)
+    expect(tostring(flags[2])).to.be_equal_to("q")
+    expect(flags[1]:is_bool()).to.be_truthy()
+
+    local regs = ctx:bv_consts("r", 4, 16)
+    expect(#regs).to.be_equal_to(4)
+    expect(regs[4]:get_sort():bv_size()).to.be_equal_to(16)
+
+    local named = ctx:bv_consts({"a", "b"}, 8)
+    expect(#named).to.be_equal_to(2)
+    expect(named[2]:get_sort():bv_size()).to.be_equal_to(8)
+    expect(#ctx:bv_consts({"a", "b", "c"}, 2, 8)).to.be_equal_to(2)
+    expect(#ctx:int_consts({"a", "b", "c"}, 1)).to.be_equal_to(1)
+
+    local ok, err = pcall(ctx.int_consts, ctx, {"a"}, 2)
+    expect(ok).to.be_falsy()
+    expect(err).to.contain("#3")
+    expect(pcall(ctx.int_consts, ctx, {"a", 1})).to.be_falsy()
+  end)
+
   it('should create literal values', function()
     local ctx = z3.Context()
     local t = ctx:bool_val(true)
@@ -51,6 +97,25 @@ describe('z3.Context', function()
     expect(tostring(n)).to.be_equal_to("42")
   end)
 
+  it('should parse SMT-LIB2 benchmarks', function()
+    local ctx = z3.Context()
+    local assertions = ctx:parse_smt2_string([[
+      (declare-const x Int)
+      (declare-const y Int)
+      (assert (> x y))
+      (assert (= (+ x y) 10))
+    ]])
+    expect(#assertions).to.be_equal_to(2)
+
+    local solver = z3.Solver(ctx)
+    for _, a in ipairs(assertions) do
+      solver:add(a)
+    end
+    expect(solver:check()).to.be_equal_to("sat")
+
+    expect(pcall(ctx.parse_smt2_string, ctx, "(assert (> undeclared 0))")).to.be_falsy()
+  end)
+
   it('should create sorts', function()
     local ctx = z3.Context()
     local bool_sort = ctx:bool_sort()
@@ -64,6 +129,20 @@ describe('z3.Context', function()
     expect(bv_sort:is_bv()).to.be_truthy()
     expect(bv_sort:bv_size()).to.be_equal_to(16)
   end)
+
+  it('should return cached literals and named constants', function()
+    local ctx = z3.Context()
+    expect(rawequal(ctx:int_val(1), ctx:int_val(1))).to.be_truthy()
+    expect(rawequal(ctx:bool_val(true), ctx:bool_val(true))).to.be_truthy()
+    expect(rawequal(ctx:int_const("x"), ctx:int_const("x"))).to.be_truthy()
+    expect(rawequal(ctx:bv_const("x", 8), ctx:bv_const("x", 8))).to.be_truthy()
+
+    -- Different sorts or contexts never share an entry.
+    expect(rawequal(ctx:int_const("x"), ctx:real_const("x"))).to.be_falsy()
+    expect(rawequal(ctx:bv_const("x", 8), ctx:bv_const("x", 16))).to.be_falsy()
+    expect(rawequal(ctx:int_val(1), z3.Context():int_val(1))).to.be_falsy()
+    expect(tostring(ctx:int_val(100000))).to.be_equal_to("100000")
+  end)
 end)
 
 describe('z3.Solver', function()
@@ -142,6 +221,185 @@ describe('z3.Solver', function()
     expect(solver:check()).to.be_equal_to("sat")
   end)
 
+  it('should check under assumptions and report the unsat core', function()
+    local ctx = z3.Context()
+    local solver = z3.Solver(ctx)
+
+    local x = ctx:int_const("x")
+    local p, q, r = ctx:bool_const("p"), ctx:bool_const("q"), ctx:bool_const("r")
+    solver:add(p:implies(x:gt(ctx:int_val(10))))
+    solver:add(q:implies(x:lt(ctx:int_val(5))))
+    solver:add(r:implies(x:eq(ctx:int_val(7))))
+
+    expect(solver:check({p, r})).to.be_equal_to("unsat")
+    local core = solver:unsat_core()
+    expect(#core).to.be_equal_to(2)
+
+    -- Assumptions do not persist between checks.
+    expect(solver:check({q})).to.be_equal_to("sat")
+    expect(solver:check()).to.be_equal_to("sat")
+  end)
+
+  it('should track named assertions in the unsat core', function()
+    local ctx = z3.Context()
+    local solver = z3.Solver(ctx)
+
+    local x = ctx:int_const("x")
+    local low = ctx:bool_const("low")
+    solver:add(x:gt(ctx:int_val(10)), low)
+    solver:add(x:lt(ctx:int_val(5)), "high")
+    solver:add(x:ne(ctx:int_val(0)), "nonzero")
+
+    expect(solver:check()).to.be_equal_to("unsat")
+    local names = {}
+    for _, lit in ipairs(solver:unsat_core()) do
+      names[tostring(lit)] = true
+    end
+    expect(names.low).to.be_truthy()
+    expect(names.high).to.be_truthy()
+    expect(names.nonzero).to.be_falsy()
+  end)
+
+  it('should honor per-check limits', function()
+    local ctx = z3.Context()
+    local solver = z3.Solver(ctx)
+
+    -- x^3 + y^3 = z^3 has no positive solution, and Z3 cannot prove it.
+    local x, y, z_var = ctx:int_const("x"), ctx:int_const("y"), ctx:int_const("z")
+    solver:add(z3.And(x:gt(ctx:int_val(0)), y:gt(ctx:int_val(0)), z_var:gt(ctx:int_val(0))))
+    solver:add((x * x * x + y * y * y):eq(z_var * z_var * z_var))
+
+    expect(solver:check{timeout_ms = 100}).to.be_equal_to("unknown")
+    expect(solver:reason_unknown()).to_not.be_equal_to("")
+  end)
+
+  it('should lift per-check limits afterwards', function()
+    local ctx = z3.Context()
+    local solver = z3.Solver(ctx)
+
+    local x = ctx:int_const("x")
+    solver:add(x:gt(ctx:int_val(0)))
+    expect(solver:check{rlimit = 1000000}).to.be_equal_to("sat")
+    expect(solver:check()).to.be_equal_to("sat")
+
+  end)
+
+  it('should take limits after empty assumptions', function()
+    local ctx = z3.Context()
+    local solver = z3.Solver(ctx)
+    pigeonhole(ctx, solver)
+
+    expect(solver:check({rlimit = 10000})).to.be_equal_to("unknown")
+    expect(solver:check({}, {rlimit = 10000})).to.be_equal_to("unknown")
+    expect(solver:check(ctx:expr_vector(), {rlimit = 10000})).to.be_equal_to("unknown")
+    expect(solver:check_async({}, {rlimit = 10000}):wait()).to.be_equal_to("unknown")
+    expect(pcall(solver.check, solver, {}, {rlimit = 10000}, {})).to.be_falsy()
+  end)
+
+  it('should lift per-check limits after a failed check', function()
+    local ctx = z3.Context()
+    local solver = z3.Solver(ctx)
+    pigeonhole(ctx, solver)
+
+    -- A non-Boolean assumption makes Z3 raise after the limit was applied.
+    local x = ctx:int_const("x")
+    expect(pcall(solver.check, solver, {x}, {rlimit = 10000})).to.be_falsy()
+    expect(solver:check()).to.be_equal_to("unsat")
+  end)
+
+  it('should accept solver parameters', function()
+    local ctx = z3.Context()
+    local solver = z3.Solver(ctx)
+
+    local x, y, z_var = ctx:int_const("x"), ctx:int_const("y"), ctx:int_const("z")
+    solver:add(z3.And(x:gt(ctx:int_val(0)), y:gt(ctx:int_val(0)), z_var:gt(ctx:int_val(0))))
+    solver:add((x * x * x + y * y * y):eq(z_var * z_var * z_var))
+
+    solver:set{timeout = 100}
+    expect(solver:check()).to.be_equal_to("unknown")
+
+    expect(pcall(solver.set, solver, {no_such_parameter = true})).to.be_falsy()
+    expect(pcall(solver.check, solver, {random_seed = 1})).to.be_falsy()
+  end)
+
+  it('should check on a worker thread', function()
+    local ctx = z3.Context()
+    local solver = z3.Solver(ctx)
+
+    local x = ctx:int_const("x")
+    solver:add(x:eq(ctx:int_val(42)))
+
+    local handle = solver:check_async()
+    expect(handle:wait()).to.be_equal_to("sat")
+    expect(handle:done()).to.be_truthy()
+    expect(handle:result()).to.be_equal_to("sat")
+    expect(handle:get_model():get_value(x)).to.be_equal_to(42)
+
+    -- The solver itself was not consumed by the background check.
+    expect(solver:check()).to.be_equal_to("sat")
+  end)
+
+  it('should cancel a background check', function()
+    local ctx = z3.Context()
+    local solver = z3.Solver(ctx)
+
+    local x, y, z_var = ctx:int_const("x"), ctx:int_const("y"), ctx:int_const("z")
+    solver:add(z3.And(x:gt(ctx:int_val(0)), y:gt(ctx:int_val(0)), z_var:gt(ctx:int_val(0))))
+    solver:add((x * x * x + y * y * y):eq(z_var * z_var * z_var))
+
+    local handle = solver:check_async()
+    handle:cancel()
+    expect(handle:wait()).to.be_equal_to("unknown")
+    expect(handle:reason_unknown()).to_not.be_equal_to("")
+
+    -- Collecting a handle that is still running stops its worker.
+    handle = solver:check_async()
+    handle = nil
+    collectgarbage()
+    collectgarbage()
+  end)
+
+  it('should keep the result when cancelled after finishing', function()
+    local ctx = z3.Context()
+    local x = ctx:int_const("x")
+    local solver = z3.Solver(ctx)
+    solver:add(x:eq(7))
+
+    local handle = solver:check_async()
+    expect(handle:wait()).to.be_equal_to("sat")
+    handle:cancel()
+    expect(handle:result()).to.be_equal_to("sat")
+    expect(handle:get_model():get_value(x)).to.be_equal_to(7)
+  end)
+
+  it('should keep solver:set parameters in a background check', function()
+    local ctx = z3.Context()
+    local solver = z3.Solver(ctx)
+    pigeonhole(ctx, solver)
+    solver:set{rlimit = 10000}
+
+    expect(solver:check()).to.be_equal_to("unknown")
+    expect(solver:check_async():wait()).to.be_equal_to("unknown")
+    expect(solver:check_async({timeout_ms = 60000}):wait()).to.be_equal_to("unknown")
+  end)
+
+  it('should load SMT-LIB2 assertions directly', function()
+    local ctx = z3.Context()
+    local solver = z3.Solver(ctx)
+    solver:from_string([[
+      (declare-const x Int)
+      (assert (> x 10))
+      (assert (< x 5))
+    ]])
+    expect(#solver:assertions()).to.be_equal_to(2)
+    expect(solver:check()).to.be_equal_to("unsat")
+
+    -- A round trip through to_smt2 preserves the problem.
+    local copy = z3.Solver(ctx)
+    copy:from_string(solver:to_smt2())
+    expect(copy:check()).to.be_equal_to("unsat")
+  end)
+
   it('should output SMT-LIB2 format', function()
     local ctx = z3.Context()
     local solver = z3.Solver(ctx)
@@ -153,6 +411,144 @@ describe('z3.Solver', function()
     expect(smt2).to.contain("declare-fun")
     expect(smt2).to.contain("assert")
   end)
+
+  it('should stream SMT-LIB2 to a file', function()
+    local ctx = z3.Context()
+    local x = ctx:int_const("x")
+    local y = ctx:int_const("y")
+    local solver = z3.Solver(ctx)
+    solver:add(x:gt(10))
+    solver:add(x:lt(y))
+    local path = os.tmpname()
+    local declared = solver:write_smt2(path)
+
+    local copy = z3.Solver(ctx)
+    copy:from_file(path)
+    expect(#copy:assertions()).to.be_equal_to(2)
+    expect(copy:check()).to.be_equal_to("sat")
+
+    -- An incremental dump only declares what is new.
+    local z = ctx:int_const("z")
+    y:lt(z):write(path, {append = true, declared = declared})
+    local file = io.open(path)
+    local text = file:read("*a")
+    file:close()
+    os.remove(path)
+    local _, declarations = text:gsub("declare%-fun", "")
+    expect(declarations).to.be_equal_to(3)
+    expect(pcall(x.write, x + 1, path)).to.be_falsy()
+  end)
+
+  it('should translate solvers and expressions between contexts', function()
+    local ctx = z3.Context()
+    local x = ctx:int_const("x")
+    local base = z3.Solver(ctx)
+    base:add(x:gt(0))
+    base:add(x:lt(10))
+
+    local other = z3.Context()
+    local copy = base:translate(other)
+    local y = x:translate(other)
+    expect(tostring(y)).to.be_equal_to("x")
+    expect(#copy:assertions()).to.be_equal_to(2)
+
+    copy:add(y:gt(20))
+    expect(copy:check()).to.be_equal_to("unsat")
+    expect(base:check()).to.be_equal_to("sat")
+    expect(#base:assertions()).to.be_equal_to(2)
+  end)
+
+  it('should keep solver:set parameters on a translated solver', function()
+    local ctx = z3.Context()
+    local base = z3.Solver(ctx)
+    pigeonhole(ctx, base)
+    base:set{rlimit = 10000}
+
+    local copy = base:translate(z3.Context())
+    expect(copy:check{timeout_ms = 60000}).to.be_equal_to("unknown")
+    -- The per-check timeout is lifted, the rlimit from set stays.
+    expect(copy:check()).to.be_equal_to("unknown")
+  end)
+
+  it('should enumerate all models natively', function()
+    local ctx = z3.Context()
+    local x = ctx:int_const("x")
+    local y = ctx:int_const("y")
+    local solver = z3.Solver(ctx)
+    solver:add(x:ge(ctx:int_val(1)))
+    solver:add(x:le(ctx:int_val(3)))
+    solver:add(y:eq(x + x))
+
+    local models, status = solver:all_models({x, y})
+    expect(#models).to.be_equal_to(3)
+    expect(status).to.be_equal_to("unsat")
+    local seen = {}
+    for _, m in ipairs(models) do
+      expect(m[2]).to.be_equal_to(2 * m[1])
+      seen[m[1]] = true
+    end
+    expect(seen[1] and seen[2] and seen[3]).to.be_truthy()
+
+    -- Blocking clauses do not outlive the enumeration.
+    expect(#solver:assertions()).to.be_equal_to(3)
+
+    local limited, why = solver:all_models({x}, 2)
+    expect(#limited).to.be_equal_to(2)
+    expect(why).to.be_equal_to("limit")
+  end)
+
+  it('should block only the projected variables', function()
+    local ctx = z3.Context()
+    local a = ctx:bool_const("a")
+    local b = ctx:bool_const("b")
+    local solver = z3.Solver(ctx)
+
+    local models = solver:all_models({a, b})
+    expect(#models).to.be_equal_to(4)
+
+    local projected = solver:all_models({a, b}, nil, {a})
+    expect(#projected).to.be_equal_to(2)
+  end)
+
+  it('should return statistics as a table of numbers', function()
+    local ctx = z3.Context()
+    local solver = z3.Solver(ctx)
+    local x = ctx:int_const("x")
+    solver:add(x:gt(ctx:int_val(0)))
+    solver:check()
+
+    local stats = solver:statistics()
+    local count = 0
+    for key, value in pairs(stats) do
+      expect(type(key)).to.be_equal_to("string")
+      expect(type(value)).to.be_equal_to("number")
+      count = count + 1
+    end
+    expect(count > 0).to.be_truthy()
+  end)
+
+  it('should record metrics only when instrumented', function()
+    local ctx = z3.Context()
+    local solver = z3.Solver(ctx)
+    local x = ctx:int_const("x")
+    solver:add(x:gt(ctx:int_val(0)))
+    expect(solver:metrics()).to.be_falsy()
+
+    solver:instrument(true)
+    solver:add(ctx:int_consts("y", 2)[1]:lt(x))
+    solver:add(x:lt(ctx:int_val(10)))
+    solver:check()
+    solver:check()
+
+    local metrics = solver:metrics()
+    expect(metrics.checks).to.be_equal_to(2)
+    expect(metrics.adds).to.be_equal_to(2)
+    expect(metrics.assertions).to.be_equal_to(3)
+    expect(metrics.check_seconds >= metrics.max_check_seconds).to.be_truthy()
+
+    solver:instrument(false)
+    expect(solver:metrics()).to.be_falsy()
+  end)
 end)
 
 describe('z3.expr arithmetic', function()
@@ -190,6 +586,142 @@ describe('z3.expr arithmetic', function()
     local neg = -x
     expect(tostring(neg)).to.contain("-")
   end)
+
+  it('should accept Lua numbers on either side', function()
+    local ctx = z3.Context()
+    local x = ctx:int_const("x")
+    expect(tostring(x + 1)).to.be_equal_to("(+ x 1)")
+    expect(tostring(1 + x)).to.be_equal_to("(+ 1 x)")
+    expect(tostring(10 - x)).to.be_equal_to("(- 10 x)")
+    expect(tostring(x:lt(5))).to.be_equal_to("(< x 5)")
+    expect(tostring(x % 3)).to.be_equal_to("(mod x 3)")
+
+    -- 64-bit integers are not truncated (Lua 5.3+ has a 64-bit integer type).
+    if math.type then
+      local big = x:eq(math.tointeger(2^53) + 1)
+      expect(tostring(big)).to.contain("9007199254740993")
+    end
+    expect(tostring(x:eq("123456789012345678901234567890"))).to.contain(
+        "123456789012345678901234567890")
+  end)
+
+  it('should build numerals of the operand sort', function()
+    local ctx = z3.Context()
+    local r = ctx:real_const("r")
+    local solver = z3.Solver(ctx)
+    solver:add((r * 2):eq(0.1))
+    expect(solver:check()).to.be_equal_to("sat")
+    expect(tostring(solver:get_model():eval((r * 20):eq(1)))).to.be_equal_to("true")
+
+    local b = ctx:bv_const("b", 8)
+    expect(tostring((b + 1):get_sort())).to.be_equal_to("(_ BitVec 8)")
+    expect(tostring((b:bvand(-1)):simplify())).to.be_equal_to("b")
+    local ok, err = pcall(function() return b + 0.5 end)
+    expect(ok).to.be_falsy()
+    expect(err).to.contain("must be an integer")
+
+    -- Integral values beyond 64 bits are exact, like decimal strings.
+    local w = ctx:bv_const("w", 128)
+    expect(tostring((w + 1e20):simplify())).to.be_equal_to(
+        tostring((w + "100000000000000000000"):simplify()))
+
+    local p = ctx:bool_const("p")
+    expect(tostring(p:land(true):simplify())).to.be_equal_to("p")
+  end)
+end)
+
+describe('z3.expr lifetime', function()
+  it('should keep expressions usable after their context is unreachable', function()
+    local function make()
+      local ctx = z3.Context()
+      local x = ctx:int_const("x")
+      return x + 1
+    end
+
+    local sum = make()
+    collectgarbage("collect")
+    collectgarbage("collect")
+    expect(tostring(sum)).to.be_equal_to("(+ x 1)")
+    sum = nil
+    collectgarbage("collect")
+  end)
+
+  it('should release temporary expressions', function()
+    local ctx = z3.Context()
+    local x = ctx:int_const("x")
+    for i = 1, 1000 do
+      local _ = x + x
+    end
+    collectgarbage("collect")
+    expect(tostring(x * x)).to.be_equal_to("(* x x)")
+  end)
+end)
+
+describe('z3.expr_vector', function()
+  it('should support length, indexing, push and slice', function()
+    local ctx = z3.Context()
+    local vec = ctx:expr_vector(ctx:int_consts("x", 3))
+    expect(#vec).to.be_equal_to(3)
+    expect(tostring(vec[2])).to.be_equal_to("x2")
+    expect(vec[4]).to.be_nil()
+
+    vec:push(ctx:int_const("y"))
+    expect(#vec).to.be_equal_to(4)
+
+    local tail = vec:slice(3)
+    expect(#tail).to.be_equal_to(2)
+    expect(tostring(tail[1])).to.be_equal_to("x3")
+    expect(tostring(tail[2])).to.be_equal_to("y")
+
+    local names = {}
+    for i, e in vec:iter() do
+      names[i] = tostring(e)
+    end
+    expect(table.concat(names, ",")).to.be_equal_to("x1,x2,x3,y")
+  end)
+
+  it('should push a vector onto itself', function()
+    local ctx = z3.Context()
+    local vec = ctx:expr_vector(ctx:int_consts("x", 2))
+    vec:push(vec)
+    expect(#vec).to.be_equal_to(4)
+    expect(tostring(vec[3])).to.be_equal_to("x1")
+    expect(tostring(vec[4])).to.be_equal_to("x2")
+  end)
+
+  it('should be accepted wherever arrays of expressions are', function()
+    local ctx = z3.Context()
+    local solver = z3.Solver(ctx)
+    local xs = ctx:expr_vector(ctx:int_consts("x", 3))
+
+    solver:add(z3.Distinct(xs))
+    solver:add(z3.Sum(xs):eq(ctx:int_val(3)))
+    local bounds = ctx:expr_vector()
+    for i = 1, 3 do
+      bounds:push(xs[i]:ge(ctx:int_val(0)))
+    end
+    solver:add(bounds)
+
+    local assertions = solver:assertions()
+    expect(#assertions).to.be_equal_to(5)
+
+    local p = ctx:bool_const("p")
+    solver:add(p:implies(xs[1]:eq(ctx:int_val(5))))
+    expect(solver:check(ctx:expr_vector({p}))).to.be_equal_to("unsat")
+    expect(solver:check()).to.be_equal_to("sat")
+
+    local values = solver:get_model():get_values(xs)
+    expect(values[1] + values[2] + values[3]).to.be_equal_to(3)
+  end)
+
+  it('should substitute pairs of vectors', function()
+    local ctx = z3.Context()
+    local x, y = ctx:int_const("x"), ctx:int_const("y")
+    local e = x + y
+    local from = ctx:expr_vector({x, y})
+    local to = ctx:expr_vector({ctx:int_val(1), ctx:int_val(2)})
+    expect(tostring(e:substitute(from, to):simplify())).to.be_equal_to("3")
+  end)
 end)
 
 describe('z3.expr comparisons', function()
@@ -331,6 +863,239 @@ describe('z3 module functions', function()
     expect(vy).to_not.be_equal_to(vz)
     expect(vx).to_not.be_equal_to(vz)
   end)
+
+  it('should build flat n-ary terms from an array table', function()
+    local ctx = z3.Context()
+    local solver = z3.Solver(ctx)
+
+    local bools = {}
+    local ints = {}
+    for i = 1, 100 do
+      bools[i] = ctx:bool_const("b" .. i)
+      ints[i] = ctx:int_const("x" .. i)
+    end
+
+    local all = z3.And(bools)
+    expect(tostring(all)).to_not.contain("(and (and")
+    solver:add(all)
+    solver:add(z3.Sum(ints):eq(ctx:int_val(100)))
+    for i = 1, 100 do
+      solver:add(ints[i]:eq(ctx:int_val(1)))
+    end
+    expect(solver:check()).to.be_equal_to("sat")
+
+    local model = solver:get_model()
+    expect(model:get_value(bools[50])).to.be_truthy()
+  end)
+
+  it('should support z3.Product', function()
+    local ctx = z3.Context()
+    local solver = z3.Solver(ctx)
+
+    local x = ctx:int_const("x")
+    local y = ctx:int_const("y")
+    local z_var = ctx:int_const("z")
+
+    solver:add(x:eq(ctx:int_val(2)))
+    solver:add(y:eq(ctx:int_val(3)))
+    solver:add(z_var:eq(ctx:int_val(4)))
+
+    expect(solver:check()).to.be_equal_to("sat")
+    local model = solver:get_model()
+    expect(tostring(model:eval(z3.Product({x, y, z_var})))).to.be_equal_to("24")
+  end)
+
+  it('should sum and multiply bit-vectors', function()
+    local ctx = z3.Context()
+    local a = ctx:bv_const("a", 8)
+    local b = ctx:bv_const("b", 8)
+    local c = ctx:bv_const("c", 8)
+    local solver = z3.Solver(ctx)
+    solver:add(a:eq(ctx:bv_val(2, 8)))
+    solver:add(b:eq(ctx:bv_val(3, 8)))
+    solver:add(c:eq(ctx:bv_val(100, 8)))
+    expect(solver:check()).to.be_equal_to("sat")
+
+    local model = solver:get_model()
+    expect(tostring(model:eval(z3.Sum({a, b, c})))).to.be_equal_to("#x69")
+    expect(tostring(model:eval(z3.Product({a, b, c})))).to.be_equal_to("#x58")
+  end)
+end)
+
+describe('z3.Optimize', function()
+  it('should maximize an objective', function()
+    local ctx = z3.Context()
+    local opt = z3.Optimize(ctx)
+
+    local x = ctx:int_const("x")
+    local y = ctx:int_const("y")
+    opt:add(x:le(ctx:int_val(10)))
+    opt:add(y:le(x))
+    local h = opt:maximize(x + y)
+
+    expect(opt:check()).to.be_equal_to("sat")
+    local model = opt:get_model()
+    expect(model:get_value(x)).to.be_equal_to(10)
+    expect(model:get_value(y)).to.be_equal_to(10)
+    expect(tostring(opt:upper(h))).to.be_equal_to("20")
+  end)
+
+  it('should satisfy the heaviest soft constraints', function()
+    local ctx = z3.Context()
+    local opt = z3.Optimize(ctx)
+
+    local a = ctx:bool_const("a")
+    local b = ctx:bool_const("b")
+    opt:add(z3.Not(a:land(b)))
+    opt:add_soft(a, 1, "prefs")
+    opt:add_soft(b, 5, "prefs")
+
+    expect(opt:check()).to.be_equal_to("sat")
+    local model = opt:get_model()
+    expect(model:get_value(a)).to.be_falsy()
+    expect(model:get_value(b)).to.be_truthy()
+  end)
+
+  it('should accept large numeric weights', function()
+    local ctx = z3.Context()
+    local opt = z3.Optimize(ctx)
+
+    local a = ctx:bool_const("a")
+    local b = ctx:bool_const("b")
+    opt:add(z3.Not(a:land(b)))
+    opt:add_soft(a, 1e20, "big")
+    local h = opt:add_soft(b, 5e19, "big")
+
+    expect(opt:check()).to.be_equal_to("sat")
+    local model = opt:get_model()
+    expect(model:get_value(a)).to.be_truthy()
+    expect(model:get_value(b)).to.be_falsy()
+    expect(tostring(opt:upper(h))).to.be_equal_to("50000000000000000000")
+  end)
+
+  it('should support push and pop', function()
+    local ctx = z3.Context()
+    local opt = z3.Optimize(ctx)
+
+    local x = ctx:int_const("x")
+    opt:add(x:ge(ctx:int_val(0)))
+    opt:minimize(x)
+
+    opt:push()
+    opt:add(x:ge(ctx:int_val(5)))
+    expect(opt:check()).to.be_equal_to("sat")
+    expect(opt:get_model():get_value(x)).to.be_equal_to(5)
+    opt:pop()
+
+    expect(opt:check()).to.be_equal_to("sat")
+    expect(opt:get_model():get_value(x)).to.be_equal_to(0)
+  end)
+end)
+
+describe('z3.portfolio', function()
+  it('should return the first definitive result and its config', function()
+    local ctx = z3.Context()
+    local solver = z3.Solver(ctx)
+
+    local x = ctx:int_const("x")
+    local y = ctx:int_const("y")
+    solver:add((x + y):eq(ctx:int_val(10)))
+    solver:add(x:gt(y))
+    solver:add(y:gt(ctx:int_val(2)))
+
+    local configs = {{random_seed = 1}, {random_seed = 2}}
+    local result, config, model = z3.portfolio(solver, configs)
+    expect(result).to.be_equal_to("sat")
+    expect(config == configs[1] or config == configs[2]).to.be_truthy()
+
+    local vx, vy = model:get_value(x), model:get_value(y)
+    expect(vx + vy).to.be_equal_to(10)
+    expect(vx > vy).to.be_truthy()
+  end)
+
+  it('should accept an array of assertions', function()
+    local ctx = z3.Context()
+    local x = ctx:int_const("x")
+    local result = z3.portfolio({x:gt(ctx:int_val(0)), x:lt(ctx:int_val(0))}, {{}})
+    expect(result).to.be_equal_to("unsat")
+  end)
+
+  it('should apply configs on top of solver:set parameters', function()
+    local ctx = z3.Context()
+    local solver = z3.Solver(ctx)
+    pigeonhole(ctx, solver)
+    solver:set{rlimit = 10000}
+
+    expect(solver:check()).to.be_equal_to("unknown")
+    expect(z3.portfolio(solver, {{}, {random_seed = 2}})).to.be_equal_to("unknown")
+    local result, config = z3.portfolio(solver, {{rlimit = 0}})
+    expect(result).to.be_equal_to("unsat")
+    expect(config.rlimit).to.be_equal_to(0)
+  end)
+
+  it('should reject invalid configs before solving', function()
+    local ctx = z3.Context()
+    local x = ctx:int_const("x")
+    local ok, err = pcall(z3.portfolio, {x:gt(ctx:int_val(0))}, {{}, {seed = {}}})
+    expect(ok).to.be_falsy()
+    expect(err).to.contain("unsupported type")
+  end)
+end)
+
+describe('z3 cube and conquer', function()
+  it('should iterate over cubes', function()
+    local ctx = z3.Context()
+    local bs = ctx:bool_consts("b", 4)
+    local solver = z3.Solver(ctx)
+    solver:add(z3.Or(bs))
+
+    local count = 0
+    for cube in solver:cubes() do
+      count = count + 1
+      expect(#cube >= 0).to.be_truthy()
+      if count > 100 then break end
+    end
+    expect(count > 0).to.be_truthy()
+  end)
+
+  it('should solve sat and unsat problems across threads', function()
+    local ctx = z3.Context()
+    local bs = ctx:bool_consts("b", 6)
+    local solver = z3.Solver(ctx)
+    solver:add(z3.Or(bs))
+    solver:add(z3.Not(z3.And(bs[1], bs[2])))
+
+    local result, model = z3.cube_and_conquer(solver, {threads = 2})
+    expect(result).to.be_equal_to("sat")
+    expect(model:get_value(bs[1]) and model:get_value(bs[2])).to.be_falsy()
+
+    local x = ctx:int_const("x")
+    local unsat = z3.cube_and_conquer({x:gt(ctx:int_val(0)), x:lt(ctx:int_val(0))},
+                                      {threads = 2, max_cubes = 1})
+    expect(unsat).to.be_equal_to("unsat")
+  end)
+
+  it('should keep solver:set parameters in the workers', function()
+    local ctx = z3.Context()
+    local solver = z3.Solver(ctx)
+    pigeonhole(ctx, solver)
+    solver:set{rlimit = 100}
+
+    expect(z3.cube_and_conquer(solver, {threads = 2, max_cubes = 1})).to.be_equal_to("unknown")
+    expect(z3.cube_and_conquer(solver, {threads = 2, max_cubes = 1,
+                                        params = {rlimit = 0}})).to.be_equal_to("unsat")
+  end)
+
+  it('should reject invalid params before splitting', function()
+    local ctx = z3.Context()
+    local x = ctx:int_const("x")
+    local ok, err = pcall(z3.cube_and_conquer, {x:gt(ctx:int_val(0))},
+                          {params = {seed = {}}})
+    expect(ok).to.be_falsy()
+    expect(err).to.contain("unsupported type")
+    ok = pcall(z3.cube_and_conquer, {x:gt(ctx:int_val(0))}, {split_params = 1})
+    expect(ok).to.be_falsy()
+  end)
 end)
 
 describe('z3.model', function()
@@ -357,6 +1122,30 @@ describe('z3.model', function()
     expect(count).to.be_equal_to(2)
   end)
 
+  it('should read back many values at once', function()
+    local ctx = z3.Context()
+    local solver = z3.Solver(ctx)
+
+    local xs = ctx:int_consts("x", 5)
+    local flag = ctx:bool_const("flag")
+    for i = 1, 5 do
+      solver:add(xs[i]:eq(ctx:int_val(i * 10)))
+    end
+    solver:add(flag)
+
+    expect(solver:check()).to.be_equal_to("sat")
+    local model = solver:get_model()
+
+    local values = model:get_values(xs)
+    expect(#values).to.be_equal_to(5)
+    expect(values[1]).to.be_equal_to(10)
+    expect(values[5]).to.be_equal_to(50)
+
+    local all = model:to_table()
+    expect(all.x3).to.be_equal_to(30)
+    expect(all.flag).to.be_equal_to(true)
+  end)
+
   it('should evaluate expressions', function()
     local ctx = z3.Context()
     local solver = z3.Solver(ctx)
@@ -462,5 +1251,257 @@ describe('z3 expression simplification', function()
   end)
 end)
 
+describe('z3 batched transformations', function()
+  it('should substitute many pairs in one call', function()
+    local ctx = z3.Context()
+    local xs = ctx:int_consts("x", 3)
+    local e = z3.Sum(xs)
+    local values = {ctx:int_val(1), ctx:int_val(2), ctx:int_val(3)}
+
+    local result = e:substitute(xs, values):simplify()
+    expect(tostring(result)).to.be_equal_to("6")
+
+    expect(pcall(e.substitute, e, xs, {values[1]})).to.be_falsy()
+  end)
+
+  it('should simplify many expressions with shared parameters', function()
+    local ctx = z3.Context()
+    local x = ctx:int_const("x")
+    local exprs = {x + ctx:int_val(0), x * ctx:int_val(1), (x + x):eq(x * 2)}
+
+    local simplified = z3.simplify_all(exprs)
+    expect(#simplified).to.be_equal_to(3)
+    expect(tostring(simplified[1])).to.be_equal_to("x")
+    expect(tostring(simplified[2])).to.be_equal_to("x")
+    expect(tostring(simplified[3])).to.be_equal_to("true")
+
+    local vec = z3.simplify_all(ctx:expr_vector(exprs), {arith_lhs = true})
+    expect(#vec).to.be_equal_to(3)
+    expect(#z3.simplify_all({})).to.be_equal_to(0)
+  end)
+end)
+
+describe('z3 arrays and functions', function()
+  it('should select and store on arrays', function()
+    local ctx = z3.Context()
+    local int = ctx:int_sort()
+    local a = ctx:array_const("a", int, int)
+    local i = ctx:int_const("i")
+    expect(a:get_sort():is_array()).to.be_truthy()
+
+    local solver = z3.Solver(ctx)
+    local b = a:store(i, ctx:int_val(7))
+    solver:add(b:select(i):ne(ctx:int_val(7)))
+    expect(solver:check()).to.be_equal_to("unsat")
+
+    local zeros = ctx:const_array(int, ctx:int_val(0))
+    solver = z3.Solver(ctx)
+    solver:add(zeros:select(i):eq(ctx:int_val(1)))
+    expect(solver:check()).to.be_equal_to("unsat")
+    expect(ctx:array_sort(int, ctx:bool_sort()):is_array()).to.be_truthy()
+  end)
+
+  it('should declare and apply uninterpreted functions', function()
+    local ctx = z3.Context()
+    local int = ctx:int_sort()
+    local f = ctx:func_decl("f", {int, int}, int)
+    expect(f:name()).to.be_equal_to("f")
+    expect(f:arity()).to.be_equal_to(2)
+    expect(tostring(f:range())).to.be_equal_to("Int")
+
+    local x = ctx:int_const("x")
+    local y = ctx:int_const("y")
+    expect(tostring(f(x, y))).to.be_equal_to("(f x y)")
+    expect(tostring(f({x, y}))).to.be_equal_to("(f x y)")
+    expect(tostring(f(x, 1))).to.be_equal_to("(f x 1)")
+    expect(pcall(f, x)).to.be_falsy()
+
+    local solver = z3.Solver(ctx)
+    solver:add(x:eq(y))
+    solver:add(f(x, x):ne(f(y, x)))
+    expect(solver:check()).to.be_equal_to("unsat")
+  end)
+end)
+
+describe('z3 pseudo-Boolean constraints', function()
+  it('should bound the number of true literals', function()
+    local ctx = z3.Context()
+    local bs = ctx:bool_consts("b", 5)
+    local solver = z3.Solver(ctx)
+    solver:add(z3.AtMost(bs, 2))
+    solver:add(z3.AtLeast(bs, 2))
+    expect(solver:check()).to.be_equal_to("sat")
+
+    local count = 0
+    for _, v in ipairs(solver:get_model():get_values(bs)) do
+      if v then count = count + 1 end
+    end
+    expect(count).to.be_equal_to(2)
+
+    solver:add(z3.AtLeast(ctx:expr_vector(bs), 3))
+    expect(solver:check()).to.be_equal_to("unsat")
+  end)
+
+  it('should handle weighted sums', function()
+    local ctx = z3.Context()
+    local a, b, c = ctx:bool_const("a"), ctx:bool_const("b"), ctx:bool_const("c")
+    local solver = z3.Solver(ctx)
+    solver:add(z3.PbEq({a, b, c}, {2, 3, 4}, 7))
+    solver:add(z3.PbLe({a, b}, {1, 1}, 1))
+    expect(solver:check()).to.be_equal_to("sat")
+    local m = solver:get_model()
+    expect(m:get_value(b) and m:get_value(c)).to.be_truthy()
+    expect(m:get_value(a)).to.be_falsy()
+
+    solver:add(z3.PbGe({a, c}, {5, 1}, 6))
+    expect(solver:check()).to.be_equal_to("unsat")
+    expect(pcall(z3.PbLe, {a, b}, {1}, 1)).to.be_falsy()
+  end)
+end)
+
+describe('z3 quantifiers', function()
+  it('should build universal and existential quantifiers', function()
+    local ctx = z3.Context()
+    local x = ctx:int_const("x")
+    local y = ctx:int_const("y")
+    local solver = z3.Solver(ctx)
+    solver:add(z3.ForAll({x}, (x + ctx:int_val(1)):gt(x)))
+    expect(solver:check()).to.be_equal_to("sat")
+
+    solver = z3.Solver(ctx)
+    solver:add(z3.Not(z3.Exists(x, x:gt(y))))
+    expect(solver:check()).to.be_equal_to("unsat")
+    expect(pcall(z3.ForAll, {x + y}, x:gt(y))).to.be_falsy()
+  end)
+
+  it('should accept patterns and a weight', function()
+    local ctx = z3.Context()
+    local int = ctx:int_sort()
+    local f = ctx:func_decl("f", int, int)
+    local x = ctx:int_const("x")
+    local a = ctx:int_const("a")
+
+    local pattern = ctx:pattern(f(x))
+    expect(tostring(pattern)).to.contain("f")
+
+    local axiom = z3.ForAll({x}, f(x):gt(x),
+                            {patterns = {pattern}, weight = 2, qid = "f_grows"})
+    local solver = z3.Solver(ctx)
+    solver:add(axiom)
+    solver:add(f(a):le(a))
+    expect(solver:check()).to.be_equal_to("unsat")
+
+    -- Plain terms are turned into patterns automatically.
+    local same = z3.ForAll(ctx:expr_vector({x}), f(x):gt(x), {patterns = {f(x)}})
+    expect(same:is_bool()).to.be_truthy()
+  end)
+end)
+
+describe('z3 tactics', function()
+  it('should apply a tactic to a goal', function()
+    local ctx = z3.Context()
+    local x = ctx:int_const("x")
+    local y = ctx:int_const("y")
+    local goal = z3.Goal(ctx)
+    goal:add({x:eq(y + 1), y:eq(ctx:int_val(2))})
+    expect(#goal).to.be_equal_to(2)
+
+    local subgoals = z3.Tactic(ctx, "solve-eqs"):apply(goal)
+    expect(#subgoals).to.be_equal_to(1)
+    expect(subgoals[1]:is_decided_sat()).to.be_truthy()
+  end)
+
+  it('should combine tactics', function()
+    local ctx = z3.Context()
+    local x = ctx:bv_const("x", 8)
+    local simplify = z3.Tactic(ctx, "simplify")
+    local pipeline = z3.Then(simplify, z3.Tactic(ctx, "bit-blast"))
+    local subgoals = pipeline:apply(x:eq(ctx:bv_val(3, 8)))
+    expect(#subgoals).to.be_equal_to(1)
+
+    local fallback = z3.OrElse(z3.TryFor(z3.Tactic(ctx, "fail"), 100), simplify)
+    expect(#fallback:apply(x:eq(x))).to.be_equal_to(1)
+    expect(z3.Repeat(simplify, 2)).to.be_truthy()
+    expect(z3.ParOr({simplify, z3.Tactic(ctx, "skip")})).to.be_truthy()
+    expect(pcall(z3.Tactic, ctx, "no-such-tactic")).to.be_falsy()
+  end)
+
+  it('should build a solver from a tactic', function()
+    local ctx = z3.Context()
+    local x = ctx:bv_const("x", 8)
+    local solver = z3.Then(
+        z3.Tactic(ctx, "simplify"),
+        z3.Tactic(ctx, "bit-blast"),
+        z3.Tactic(ctx, "sat")):solver()
+    solver:add(x:eq(ctx:bv_val(7, 8)))
+    expect(solver:check()).to.be_equal_to("sat")
+    expect(tostring(solver:get_model():eval(x))).to.be_equal_to("#x07")
+  end)
+end)
+
+describe('z3 datatypes', function()
+  it('should create enumeration sorts', function()
+    local ctx = z3.Context()
+    local color, values, testers = ctx:enum_sort("Color", {"red", "green", "blue"})
+    expect(tostring(color)).to.be_equal_to("Color")
+    expect(#values).to.be_equal_to(3)
+    expect(rawequal(values[1], values.red)).to.be_truthy()
+
+    local c = ctx:constant("c", color)
+    local solver = z3.Solver(ctx)
+    solver:add(c:ne(values.red))
+    solver:add(testers.green(c):lnot())
+    expect(solver:check()).to.be_equal_to("sat")
+    expect(tostring(solver:get_model():eval(c))).to.be_equal_to("blue")
+  end)
+
+  it('should create recursive datatypes', function()
+    local ctx = z3.Context()
+    local int = ctx:int_sort()
+    local list, decls = ctx:datatype("List", {
+      {"nil"},
+      {"cons", {"head", int}, {"tail", "List"}},
+    })
+    expect(tostring(list)).to.be_equal_to("List")
+
+    local l = ctx:constant("l", list)
+    local solver = z3.Solver(ctx)
+    solver:add(decls.is_cons(l))
+    solver:add(decls.head(l):eq(5))
+    solver:add(decls.tail(l):eq(decls.cons(7, decls["nil"]())))
+    expect(solver:check()).to.be_equal_to("sat")
+    expect(tostring(solver:get_model():eval(l))).to.be_equal_to("(cons 5 (cons 7 nil))")
+
+    solver:add(decls.is_nil(l))
+    expect(solver:check()).to.be_equal_to("unsat")
+  end)
+
+  it('should create mutually recursive datatypes', function()
+    local ctx = z3.Context()
+    local int = ctx:int_sort()
+    local sorts, decls = ctx:datatypes({
+      {"Tree", {{"leaf", {"value", int}}, {"node", {"children", "Forest"}}}},
+      {"Forest", {{"empty"}, {"grow", {"first", "Tree"}, {"rest", "Forest"}}}},
+    })
+    expect(#sorts).to.be_equal_to(2)
+    expect(tostring(sorts[2])).to.be_equal_to("Forest")
+
+    local tree, forest = decls[1], decls[2]
+    local t = ctx:constant("t", sorts[1])
+    local solver = z3.Solver(ctx)
+    solver:add(tree.is_node(t))
+    solver:add(forest.is_grow(tree.children(t)))
+    solver:add(tree.value(forest.first(tree.children(t))):eq(3))
+    expect(solver:check()).to.be_equal_to("sat")
+  end)
+
+  it('should reject malformed definitions', function()
+    local ctx = z3.Context()
+    expect(pcall(ctx.datatype, ctx, "T", {})).to.be_falsy()
+    expect(pcall(ctx.datatype, ctx, "T", {{"a", {"x", "Unknown"}}})).to.be_falsy()
+    expect(pcall(ctx.datatype, ctx, "T", {{"a", {"a", ctx:int_sort()}}})).to.be_falsy()
+  end)
+end)
+
 -- Run all tests
 unit.run_unit_tests()